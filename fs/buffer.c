@@ -24,15 +24,67 @@
 #include <linux/sched.h>
 #include <linux/kernel.h>
 #include <asm/system.h>
+#include <asm/segment.h>
 #include <asm/io.h>
+#include <errno.h>
 
 extern int end;
 struct buffer_head * start_buffer = (struct buffer_head *) &end;
 struct buffer_head * hash_table[NR_HASH];
-static struct buffer_head * free_list;
-static struct task_struct * buffer_wait = NULL;
+static struct buffer_head * dev_table[NR_DEVHASH];
+static struct wait_queue * buffer_wait = NULL;
 int NR_BUFFERS = 0;
 
+/*
+ * The buffers are kept on two circular lru-lists, one for clean and
+ * one for dirty buffers. The head of the clean list is the least
+ * recently used buffer, brelse() puts buffers back at the tail. The
+ * dirty list is kept in the order the buffers got dirty, so that
+ * bdflush finds the oldest ones first. Note that a buffer is only
+ * moved between the lists when it is refiled, so b_dirt must still be
+ * checked: the lists are just a good guess.
+ */
+#define BUF_CLEAN	0
+#define BUF_DIRTY	1
+#define NR_LIST		2
+
+static struct buffer_head * lru_list[NR_LIST] = { NULL, NULL };
+static int nr_buffers_type[NR_LIST] = { 0, 0 };
+
+/*
+ * bdflush parameters, read and set with sys_bdflush(). The daemon
+ * wakes up every 'interval' jiffies and writes buffers that have been
+ * dirty for longer than 'age_buffer', at most 'ndirty' at a time. It is
+ * also woken when more than 'nfract' percent of the buffers are dirty,
+ * in which case it writes the oldest ones regardless of their age.
+ */
+#define NR_BDFLUSH_PARAM 4
+#define BDFLUSH_BATCH	64
+
+static union bdflush_param {
+	struct {
+		int nfract;	/* percentage of buffers dirty to activate bdflush */
+		int ndirty;	/* max buffers written per batch */
+		int interval;	/* jiffies between wake-ups */
+		int age_buffer;	/* jiffies a buffer may stay dirty */
+	} b_un;
+	int data[NR_BDFLUSH_PARAM];
+} bdf_prm = {{40, 16, 5*HZ, 30*HZ}};
+
+static int bdflush_min[NR_BDFLUSH_PARAM] = {1, 1, HZ/10, HZ/10};
+static int bdflush_max[NR_BDFLUSH_PARAM] = {100, BDFLUSH_BATCH, 60*HZ, 600*HZ};
+
+static struct wait_queue * bdflush_wait = NULL;
+static int bdflush_running = 0;
+
+#define too_many_dirty() \
+(nr_buffers_type[BUF_DIRTY]*100 > bdf_prm.b_un.nfract*NR_BUFFERS)
+
+#define _hashfn(dev,block) (((unsigned)(dev^block))%NR_HASH)
+#define hash(dev,block) hash_table[_hashfn(dev,block)]
+#define _devhashfn(dev) (((unsigned)(dev))%NR_DEVHASH)
+#define dev_list(dev) dev_table[_devhashfn(dev)]
+
 static inline void wait_on_buffer(struct buffer_head * bh)
 {
 	cli();
@@ -41,58 +93,111 @@ static inline void wait_on_buffer(struct buffer_head * bh)
 	sti();
 }
 
-int sys_sync(void)
+static inline void remove_from_lru(struct buffer_head * bh)
 {
-	int i;
-	struct buffer_head * bh;
+	if (!(bh->b_prev_free) || !(bh->b_next_free))
+		panic("Free block list corrupted");
+	nr_buffers_type[bh->b_list]--;
+	if (bh->b_next_free == bh) {
+		lru_list[bh->b_list] = NULL;
+		return;
+	}
+	bh->b_prev_free->b_next_free = bh->b_next_free;
+	bh->b_next_free->b_prev_free = bh->b_prev_free;
+	if (lru_list[bh->b_list] == bh)
+		lru_list[bh->b_list] = bh->b_next_free;
+}
 
-	sync_inodes();		/* write out inodes into buffers */
-	bh = start_buffer;
-	for (i=0 ; i<NR_BUFFERS ; i++,bh++) {
-		wait_on_buffer(bh);
-		if (bh->b_dirt)
-			ll_rw_block(WRITE,bh);
+static inline void add_to_lru(struct buffer_head * bh)
+{
+	struct buffer_head * head;
+
+	if (bh->b_dirt) {
+		bh->b_list = BUF_DIRTY;
+		bh->b_flushtime = jiffies + bdf_prm.b_un.age_buffer;
+	} else
+		bh->b_list = BUF_CLEAN;
+	nr_buffers_type[bh->b_list]++;
+	if (!(head = lru_list[bh->b_list])) {
+		lru_list[bh->b_list] = bh->b_next_free = bh->b_prev_free = bh;
+		return;
 	}
-	return 0;
+	bh->b_next_free = head;
+	bh->b_prev_free = head->b_prev_free;
+	head->b_prev_free->b_next_free = bh;
+	head->b_prev_free = bh;
 }
 
-int sync_dev(int dev)
+/*
+ * refile_buffer() puts the buffer at the tail of the list that
+ * matches its current dirt-status. Buffers that already are on the
+ * dirty list stay where they are, so as not to reset their age.
+ */
+static inline void refile_buffer(struct buffer_head * bh)
+{
+	if (bh->b_dirt && bh->b_list == BUF_DIRTY)
+		return;
+	remove_from_lru(bh);
+	add_to_lru(bh);
+}
+
+/*
+ * Write out the dirty buffers on one device-chain (all of them if
+ * dev is 0). ll_rw_block() on an unlocked buffer keeps it locked while
+ * it sleeps, so it can't be re-used under us and we may continue the
+ * walk from it. After waiting on a locked buffer we have to restart.
+ */
+static void write_chain(int chain, int dev)
 {
-	int i;
 	struct buffer_head * bh;
 
-	bh = start_buffer;
-	for (i=0 ; i<NR_BUFFERS ; i++,bh++) {
-		if (bh->b_dev != dev)
+repeat:
+	for (bh = dev_table[chain] ; bh ; bh = bh->b_next_dev) {
+		if ((dev && bh->b_dev != dev) || !bh->b_dirt)
 			continue;
-		wait_on_buffer(bh);
-		if (bh->b_dev == dev && bh->b_dirt)
-			ll_rw_block(WRITE,bh);
+		if (bh->b_lock) {
+			wait_on_buffer(bh);
+			goto repeat;
+		}
+		ll_rw_block(WRITE,bh);
+		refile_buffer(bh);
 	}
+}
+
+int sys_sync(void)
+{
+	int i;
+
+	sync_inodes();		/* write out inodes into buffers */
+	for (i=0 ; i<NR_DEVHASH ; i++)
+		write_chain(i,0);
+	return 0;
+}
+
+int sync_dev(int dev)
+{
+	write_chain(_devhashfn(dev),dev);
 	sync_inodes();
-	bh = start_buffer;
-	for (i=0 ; i<NR_BUFFERS ; i++,bh++) {
-		if (bh->b_dev != dev)
-			continue;
-		wait_on_buffer(bh);
-		if (bh->b_dev == dev && bh->b_dirt)
-			ll_rw_block(WRITE,bh);
-	}
+	write_chain(_devhashfn(dev),dev);
 	return 0;
 }
 
 void inline invalidate_buffers(int dev)
 {
-	int i;
 	struct buffer_head * bh;
 
-	bh = start_buffer;
-	for (i=0 ; i<NR_BUFFERS ; i++,bh++) {
+repeat:
+	for (bh = dev_list(dev) ; bh ; bh = bh->b_next_dev) {
 		if (bh->b_dev != dev)
 			continue;
-		wait_on_buffer(bh);
-		if (bh->b_dev == dev)
+		if (bh->b_lock) {
+			wait_on_buffer(bh);
+			goto repeat;
+		}
+		if (bh->b_uptodate || bh->b_dirt) {
 			bh->b_uptodate = bh->b_dirt = 0;
+			refile_buffer(bh);
+		}
 	}
 }
 
@@ -125,9 +230,6 @@ void check_disk_change(int dev)
 	invalidate_buffers(dev);
 }
 
-#define _hashfn(dev,block) (((unsigned)(dev^block))%NR_HASH)
-#define hash(dev,block) hash_table[_hashfn(dev,block)]
-
 static inline void remove_from_queues(struct buffer_head * bh)
 {
 /* remove from hash-queue */
@@ -137,30 +239,34 @@ static inline void remove_from_queues(struct buffer_head * bh)
 		bh->b_prev->b_next = bh->b_next;
 	if (hash(bh->b_dev,bh->b_blocknr) == bh)
 		hash(bh->b_dev,bh->b_blocknr) = bh->b_next;
-/* remove from free list */
-	if (!(bh->b_prev_free) || !(bh->b_next_free))
-		panic("Free block list corrupted");
-	bh->b_prev_free->b_next_free = bh->b_next_free;
-	bh->b_next_free->b_prev_free = bh->b_prev_free;
-	if (free_list == bh)
-		free_list = bh->b_next_free;
+/* remove from device-chain */
+	if (bh->b_next_dev)
+		bh->b_next_dev->b_prev_dev = bh->b_prev_dev;
+	if (bh->b_prev_dev)
+		bh->b_prev_dev->b_next_dev = bh->b_next_dev;
+	if (dev_list(bh->b_dev) == bh)
+		dev_list(bh->b_dev) = bh->b_next_dev;
+/* remove from lru list */
+	remove_from_lru(bh);
 }
 
 static inline void insert_into_queues(struct buffer_head * bh)
 {
-/* put at end of free list */
-	bh->b_next_free = free_list;
-	bh->b_prev_free = free_list->b_prev_free;
-	free_list->b_prev_free->b_next_free = bh;
-	free_list->b_prev_free = bh;
-/* put the buffer in new hash-queue if it has a device */
+/* put at end of lru list */
+	add_to_lru(bh);
+/* put the buffer in new hash-queue and device-chain if it has a device */
 	bh->b_prev = NULL;
 	bh->b_next = NULL;
+	bh->b_prev_dev = NULL;
+	bh->b_next_dev = NULL;
 	if (!bh->b_dev)
 		return;
-	bh->b_next = hash(bh->b_dev,bh->b_blocknr);
+	if (bh->b_next = hash(bh->b_dev,bh->b_blocknr))
+		bh->b_next->b_prev = bh;
 	hash(bh->b_dev,bh->b_blocknr) = bh;
-	bh->b_next->b_prev = bh;
+	if (bh->b_next_dev = dev_list(bh->b_dev))
+		bh->b_next_dev->b_prev_dev = bh;
+	dev_list(bh->b_dev) = bh;
 }
 
 static struct buffer_head * find_buffer(int dev, int block)
@@ -195,41 +301,58 @@ struct buffer_head * get_hash_table(int dev, int block)
 	}
 }
 
+/*
+ * get_free_buffer() finds a buffer to re-use. Clean buffers are taken
+ * from the head of their lru-list: anything in use or locked that we
+ * meet there is rotated to the tail, so getblk() doesn't have to look
+ * at it again until the whole list has been cycled through. Only when
+ * no clean buffer is free do we fall back on the oldest dirty one, and
+ * when every unused buffer is locked we return one of those to wait on.
+ */
+static struct buffer_head * get_free_buffer(void)
+{
+	struct buffer_head * bh;
+	int i, n;
+
+	for (n=nr_buffers_type[BUF_CLEAN] ; n-- > 0 ;
+	     lru_list[BUF_CLEAN] = bh->b_next_free)
+		if (!(bh = lru_list[BUF_CLEAN])->b_count && !bh->b_lock)
+			return bh;
+	for (n=nr_buffers_type[BUF_DIRTY], bh=lru_list[BUF_DIRTY] ; n-- > 0 ;
+	     bh = bh->b_next_free)
+		if (!bh->b_count && !bh->b_lock)
+			return bh;
+	for (i=BUF_CLEAN ; i<NR_LIST ; i++)
+		for (n=nr_buffers_type[i], bh=lru_list[i] ; n-- > 0 ;
+		     bh = bh->b_next_free)
+			if (!bh->b_count)
+				return bh;
+	return NULL;
+}
+
 /*
  * Ok, this is getblk, and it isn't very clear, again to hinder
  * race-conditions. Most of the code is seldom used, (ie repeating),
  * so it should be much more efficient than it looks.
- *
- * The algoritm is changed: hopefully better, and an elusive bug removed.
  */
-#define BADNESS(bh) (((bh)->b_dirt<<1)+(bh)->b_lock)
 struct buffer_head * getblk(int dev,int block)
 {
-	struct buffer_head * tmp, * bh;
+	struct buffer_head * bh;
 
 repeat:
 	if (bh = get_hash_table(dev,block))
 		return bh;
-	tmp = free_list;
-	do {
-		if (tmp->b_count)
-			continue;
-		if (!bh || BADNESS(tmp)<BADNESS(bh)) {
-			bh = tmp;
-			if (!BADNESS(tmp))
-				break;
-		}
-/* and repeat until we find something good */
-	} while ((tmp = tmp->b_next_free) != free_list);
-	if (!bh) {
-		sleep_on(&buffer_wait);
+	if (!(bh = get_free_buffer())) {
+		sleep_on_exclusive(&buffer_wait);
 		goto repeat;
 	}
 	wait_on_buffer(bh);
 	if (bh->b_count)
 		goto repeat;
 	while (bh->b_dirt) {
-		sync_dev(bh->b_dev);
+		wake_up(&bdflush_wait);
+		ll_rw_block(WRITE,bh);
+		refile_buffer(bh);
 		wait_on_buffer(bh);
 		if (bh->b_count)
 			goto repeat;
@@ -257,6 +380,9 @@ void brelse(struct buffer_head * buf)
 	wait_on_buffer(buf);
 	if (!(buf->b_count--))
 		panic("Trying to free free buffer");
+	refile_buffer(buf);
+	if (buf->b_dirt && too_many_dirty())
+		wake_up(&bdflush_wait);
 	wake_up(&buffer_wait);
 }
 
@@ -333,7 +459,7 @@ struct buffer_head * breada(int dev,int first, ...)
 		tmp=getblk(dev,first);
 		if (tmp) {
 			if (!tmp->b_uptodate)
-				ll_rw_block(READA,bh);
+				ll_rw_block(READA,tmp);
 			tmp->b_count--;
 		}
 	}
@@ -345,6 +471,102 @@ struct buffer_head * breada(int dev,int first, ...)
 	return (NULL);
 }
 
+/*
+ * bread_ahead() starts reading a block if it isn't in the cache, but
+ * doesn't wait for it: a later bread() will find it (or find it being
+ * read). The READA may be dropped if the request queue is full.
+ */
+void bread_ahead(int dev,int block)
+{
+	struct buffer_head * bh;
+
+	if (!(bh=getblk(dev,block)))
+		return;
+	if (!bh->b_uptodate && !bh->b_lock)
+		ll_rw_block(READA,bh);
+	bh->b_count--;
+}
+
+/*
+ * flush_dirty() writes out one batch of dirty buffers: the ones whose
+ * time is up, or simply the oldest ones if 'all' is set. The batch is
+ * sorted by device and block number before it is handed to the driver,
+ * so that the elevator gets the requests in a sensible order.
+ */
+static int flush_dirty(int all)
+{
+	struct buffer_head * batch[BDFLUSH_BATCH], * bh;
+	int i, n, nr = 0;
+
+	for (n=nr_buffers_type[BUF_DIRTY], bh=lru_list[BUF_DIRTY] ;
+	     n-- > 0 && nr < bdf_prm.b_un.ndirty ; bh = bh->b_next_free) {
+		if (!all && bh->b_flushtime > jiffies)
+			break;
+		if (!bh->b_dirt || bh->b_lock)
+			continue;
+		for (i = nr++ ; i > 0 ; i--) {
+			if (batch[i-1]->b_dev < bh->b_dev)
+				break;
+			if (batch[i-1]->b_dev == bh->b_dev &&
+			    batch[i-1]->b_blocknr < bh->b_blocknr)
+				break;
+			batch[i] = batch[i-1];
+		}
+		batch[i] = bh;
+	}
+	for (i=0 ; i<nr ; i++) {
+		ll_rw_block(WRITE,batch[i]);
+		refile_buffer(batch[i]);
+	}
+	return nr;
+}
+
+/*
+ * sys_bdflush() is used both to start the buffer flushing daemon and to
+ * tune it: func 0 turns the calling process into the daemon (it only
+ * returns when it gets a signal), func 1 writes one batch of old buffers,
+ * and func 2 and up read (even) or write (odd) parameter (func-2)/2.
+ */
+int sys_bdflush(int func, long data)
+{
+	int i;
+
+	if (!suser())
+		return -EPERM;
+	if (func == 1)
+		return flush_dirty(0);
+	if (func >= 2) {
+		i = (func-2) >> 1;
+		if (i >= NR_BDFLUSH_PARAM)
+			return -EINVAL;
+		if (!(func & 1)) {
+			verify_area((void *) data,4);
+			put_fs_long(bdf_prm.data[i],(unsigned long *) data);
+			return 0;
+		}
+		if (data < bdflush_min[i] || data > bdflush_max[i])
+			return -EINVAL;
+		bdf_prm.data[i] = data;
+		return 0;
+	}
+	if (func)
+		return -EINVAL;
+	if (bdflush_running)
+		return -EBUSY;
+	bdflush_running = 1;
+	for (;;) {
+		while (flush_dirty(too_many_dirty()) >= bdf_prm.b_un.ndirty)
+			/* nothing */;
+		if (current->signal & ~current->blocked)
+			break;
+		current->timeout = jiffies + bdf_prm.b_un.interval;
+		interruptible_sleep_on(&bdflush_wait);
+		current->timeout = 0;
+	}
+	bdflush_running = 0;
+	return -EINTR;
+}
+
 void buffer_init(long buffer_end)
 {
 	struct buffer_head * h = start_buffer;
@@ -361,9 +583,12 @@ void buffer_init(long buffer_end)
 		h->b_count = 0;
 		h->b_lock = 0;
 		h->b_uptodate = 0;
+		h->b_list = BUF_CLEAN;
 		h->b_wait = NULL;
 		h->b_next = NULL;
 		h->b_prev = NULL;
+		h->b_next_dev = NULL;
+		h->b_prev_dev = NULL;
 		h->b_data = (char *) b;
 		h->b_prev_free = h-1;
 		h->b_next_free = h+1;
@@ -373,9 +598,12 @@ void buffer_init(long buffer_end)
 			b = (void *) 0xA0000;
 	}
 	h--;
-	free_list = start_buffer;
-	free_list->b_prev_free = h;
-	h->b_next_free = free_list;
+	lru_list[BUF_CLEAN] = start_buffer;
+	lru_list[BUF_CLEAN]->b_prev_free = h;
+	h->b_next_free = lru_list[BUF_CLEAN];
+	nr_buffers_type[BUF_CLEAN] = NR_BUFFERS;
 	for (i=0;i<NR_HASH;i++)
 		hash_table[i]=NULL;
-}	
+	for (i=0;i<NR_DEVHASH;i++)
+		dev_table[i]=NULL;
+}
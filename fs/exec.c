@@ -356,8 +356,10 @@ restart_interp:
 		if ((current->close_on_exec>>i)&1)
 			sys_close(i);
 	current->close_on_exec = 0;
+	exit_mmap();
 	free_page_tables(get_base(current->ldt[1]),get_limit(0x0f));
 	free_page_tables(get_base(current->ldt[2]),get_limit(0x17));
+	vfork_done();
 	if (last_task_used_math == current)
 		last_task_used_math = NULL;
 	current->used_math = 0;
@@ -14,43 +14,105 @@
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #define MAX(a,b) (((a)>(b))?(a):(b))
 
+/*
+ * Readahead window sizes, in blocks. The window doubles every time a
+ * read carries on where the last one stopped, and is halved by a read
+ * somewhere else.
+ */
+#define READA_MIN	4
+#define READA_MAX	32
+
+/*
+ * file_readahead() starts reading the blocks of this read, and those
+ * in the window behind it, before file_read() waits for the first one.
+ * That way the requests go to the driver together (and are merged),
+ * and the next read finds its blocks on the way. Blocks already asked
+ * for (before f_raend) aren't asked for again.
+ */
+static void file_readahead(struct m_inode * inode, struct file * filp,
+	int count)
+{
+	unsigned long block,end;
+	int nr;
+
+	block = filp->f_pos / BLOCK_SIZE;
+	if (block == filp->f_nextblock) {
+		if (!filp->f_rawin)
+			filp->f_rawin = READA_MIN;
+		else if (filp->f_rawin < READA_MAX)
+			filp->f_rawin <<= 1;
+	} else {
+		filp->f_rawin >>= 1;
+		filp->f_raend = 0;
+	}
+	end = (filp->f_pos + count - 1) / BLOCK_SIZE + filp->f_rawin;
+	end = MIN(end, block + READA_MAX);
+	end = MIN(end, (inode->i_size - 1) / BLOCK_SIZE);
+	block = MAX(block, filp->f_raend);
+	for ( ; block <= end ; block++)
+		if (nr = bmap(inode,block))
+			bread_ahead(inode->i_dev,nr);
+	filp->f_raend = MAX(filp->f_raend, end + 1);
+}
+
+/*
+ * A block that is in the page cache is read from there: a shared
+ * mapping may have changed it since it was last written back.
+ */
 int file_read(struct m_inode * inode, struct file * filp, char * buf, int count)
 {
 	int left,chars,nr;
 	struct buffer_head * bh;
+	unsigned long page;
+	char * p;
 
 	if ((left=count)<=0)
 		return 0;
+	if (inode->i_size > 0)
+		file_readahead(inode,filp,count);
 	while (left) {
-		if (nr = bmap(inode,(filp->f_pos)/BLOCK_SIZE)) {
+		bh = NULL;
+		p = NULL;
+		if (page = find_block_page(inode,filp->f_pos/BLOCK_SIZE,&nr))
+			p = nr + (char *) page;
+		else if (nr = bmap(inode,(filp->f_pos)/BLOCK_SIZE)) {
 			if (!(bh=bread(inode->i_dev,nr)))
 				break;
-		} else
-			bh = NULL;
+			p = bh->b_data;
+		}
 		nr = filp->f_pos % BLOCK_SIZE;
 		chars = MIN( BLOCK_SIZE-nr , left );
 		filp->f_pos += chars;
 		left -= chars;
-		if (bh) {
-			char * p = nr + bh->b_data;
+		if (p) {
+			p += nr;
 			while (chars-->0)
 				put_fs_byte(*(p++),buf++);
-			brelse(bh);
+			if (bh)
+				brelse(bh);
+			else
+				free_page(page);
 		} else {
 			while (chars-->0)
 				put_fs_byte(0,buf++);
 		}
 	}
+	filp->f_nextblock = filp->f_pos / BLOCK_SIZE;
 	inode->i_atime = CURRENT_TIME;
 	return (count-left)?(count-left):-ERROR;
 }
 
+/*
+ * What is written goes in the cached pages of the file as well, so
+ * that shared mappings see it.
+ */
 int file_write(struct m_inode * inode, struct file * filp, char * buf, int count)
 {
 	off_t pos;
 	int block,c;
 	struct buffer_head * bh;
-	char * p;
+	char * p, * q;
+	unsigned long nr;
 	int i=0;
 
 /*
@@ -62,7 +124,8 @@ int file_write(struct m_inode * inode, struct file * filp, char * buf, int count
 	else
 		pos = filp->f_pos;
 	while (i<count) {
-		if (!(block = create_block(inode,pos/BLOCK_SIZE)))
+		nr = pos / BLOCK_SIZE;
+		if (!(block = create_block(inode,nr)))
 			break;
 		if (!(bh=bread(inode->i_dev,block)))
 			break;
@@ -77,8 +140,10 @@ int file_write(struct m_inode * inode, struct file * filp, char * buf, int count
 			inode->i_dirt = 1;
 		}
 		i += c;
+		q = p;
 		while (c-->0)
 			*(p++) = get_fs_byte(buf++);
+		update_page_cache(inode,nr,q - bh->b_data,q,p - q);
 		brelse(bh);
 	}
 	inode->i_mtime = CURRENT_TIME;
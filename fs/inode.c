@@ -16,9 +16,104 @@ extern int *blk_size[];
 
 struct m_inode inode_table[NR_INODE]={{0,},};
 
+/*
+ * Inodes that belong to a device are found through a hash on (dev,nr).
+ * The unused ones (i_count == 0) are also on a circular list, least
+ * recently used first, that get_empty_inode() takes them from: so an
+ * inode stays cached for as long as possible after its last iput().
+ * An inode is on the free list exactly when its i_count is zero.
+ */
+#define _ihashfn(dev,nr) (((unsigned)((dev)^(nr)))%NR_IHASH)
+#define ihash(dev,nr) ihash_table[_ihashfn(dev,nr)]
+
+static struct m_inode * ihash_table[NR_IHASH];
+static struct m_inode * free_inodes = NULL;
+static int nr_free_inodes = 0;
+
 static void read_inode(struct m_inode * inode);
 static void write_inode(struct m_inode * inode);
 
+static inline void remove_from_hash(struct m_inode * inode)
+{
+	if (inode->i_next)
+		inode->i_next->i_prev = inode->i_prev;
+	if (inode->i_prev)
+		inode->i_prev->i_next = inode->i_next;
+	else if (ihash(inode->i_dev,inode->i_num) == inode)
+		ihash(inode->i_dev,inode->i_num) = inode->i_next;
+	inode->i_next = inode->i_prev = NULL;
+}
+
+void insert_inode_hash(struct m_inode * inode)
+{
+	if (!inode->i_dev)
+		return;
+	inode->i_prev = NULL;
+	if (inode->i_next = ihash(inode->i_dev,inode->i_num))
+		inode->i_next->i_prev = inode;
+	ihash(inode->i_dev,inode->i_num) = inode;
+}
+
+static inline void remove_from_free(struct m_inode * inode)
+{
+	if (!inode->i_next_free)
+		panic("Free inode list corrupted");
+	inode->i_prev_free->i_next_free = inode->i_next_free;
+	inode->i_next_free->i_prev_free = inode->i_prev_free;
+	if (free_inodes == inode)
+		free_inodes = inode->i_next_free;
+	if (!--nr_free_inodes)
+		free_inodes = NULL;
+	inode->i_next_free = inode->i_prev_free = NULL;
+}
+
+static inline void put_last_free(struct m_inode * inode)
+{
+	if (!free_inodes) {
+		free_inodes = inode;
+		inode->i_prev_free = inode;
+		inode->i_next_free = inode;
+	} else {
+		inode->i_next_free = free_inodes;
+		inode->i_prev_free = free_inodes->i_prev_free;
+		free_inodes->i_prev_free->i_next_free = inode;
+		free_inodes->i_prev_free = inode;
+	}
+	nr_free_inodes++;
+}
+
+static struct m_inode * find_inode(int dev, int nr)
+{
+	struct m_inode * inode;
+
+	for (inode = ihash(dev,nr) ; inode ; inode = inode->i_next)
+		if (inode->i_dev == dev && inode->i_num == nr)
+			return inode;
+	return NULL;
+}
+
+/*
+ * clear_inode() is used when an inode is freed on disk: it is forgotten
+ * at once. The caller must hold the only reference.
+ */
+void clear_inode(struct m_inode * inode)
+{
+	invalidate_inode_pages(inode);
+	remove_from_hash(inode);
+	if (!inode->i_count)
+		remove_from_free(inode);
+	memset(inode,0,sizeof(*inode));
+	put_last_free(inode);
+}
+
+void inode_init(void)
+{
+	int i;
+
+	for (i = 0 ; i < NR_INODE ; i++)
+		put_last_free(inode_table+i);
+}
+
 static inline void wait_on_inode(struct m_inode * inode)
 {
 	cli();
@@ -31,7 +126,7 @@ static inline void lock_inode(struct m_inode * inode)
 {
 	cli();
 	while (inode->i_lock)
-		sleep_on(&inode->i_wait);
+		sleep_on_exclusive(&inode->i_wait);
 	inode->i_lock=1;
 	sti();
 }
@@ -47,12 +142,15 @@ void invalidate_inodes(int dev)
 	int i;
 	struct m_inode * inode;
 
+	invalidate_dcache(dev,0);
 	inode = 0+inode_table;
 	for(i=0 ; i<NR_INODE ; i++,inode++) {
 		wait_on_inode(inode);
 		if (inode->i_dev == dev) {
 			if (inode->i_count)
 				printk("inode in use on removed disk\n\r");
+			invalidate_inode_pages(inode);
+			remove_from_hash(inode);
 			inode->i_dev = inode->i_dirt = 0;
 		}
 	}
@@ -157,18 +255,20 @@ void iput(struct m_inode * inode)
 	if (!inode->i_count)
 		panic("iput: trying to free free inode");
 	if (inode->i_pipe) {
-		wake_up(&inode->i_wait);
-		wake_up(&inode->i_wait2);
+		wake_up_all(&inode->i_wait);
+		wake_up_all(&inode->i_wait2);
 		if (--inode->i_count)
 			return;
 		free_page(inode->i_size);
 		inode->i_count=0;
 		inode->i_dirt=0;
 		inode->i_pipe=0;
+		put_last_free(inode);
 		return;
 	}
 	if (!inode->i_dev) {
-		inode->i_count--;
+		if (!--inode->i_count)
+			put_last_free(inode);
 		return;
 	}
 	if (S_ISBLK(inode->i_mode)) {
@@ -191,26 +291,26 @@ repeat:
 		goto repeat;
 	}
 	inode->i_count--;
+	put_last_free(inode);
 	return;
 }
 
+/*
+ * get_empty_inode() takes the least recently used free inode, but
+ * prefers one that needn't be written out first.
+ */
 struct m_inode * get_empty_inode(void)
 {
 	struct m_inode * inode;
-	static struct m_inode * last_inode = inode_table;
 	int i;
 
 	do {
-		inode = NULL;
-		for (i = NR_INODE; i ; i--) {
-			if (++last_inode >= inode_table + NR_INODE)
-				last_inode = inode_table;
-			if (!last_inode->i_count) {
-				inode = last_inode;
-				if (!inode->i_dirt && !inode->i_lock)
-					break;
-			}
-		}
+		inode = free_inodes;
+		for (i = nr_free_inodes ; i-- > 0 ; inode = inode->i_next_free)
+			if (!inode->i_dirt && !inode->i_lock)
+				break;
+		if (i < 0)
+			inode = free_inodes;
 		if (!inode) {
 			for (i=0 ; i<NR_INODE ; i++)
 				printk("%04x: %6d\t",inode_table[i].i_dev,
@@ -223,6 +323,9 @@ struct m_inode * get_empty_inode(void)
 			wait_on_inode(inode);
 		}
 	} while (inode->i_count);
+	remove_from_free(inode);
+	remove_from_hash(inode);
+	invalidate_inode_pages(inode);
 	memset(inode,0,sizeof(*inode));
 	inode->i_count = 1;
 	return inode;
@@ -235,7 +338,7 @@ struct m_inode * get_pipe_inode(void)
 	if (!(inode = get_empty_inode()))
 		return NULL;
 	if (!(inode->i_size=get_free_page())) {
-		inode->i_count = 0;
+		iput(inode);
 		return NULL;
 	}
 	inode->i_count = 2;	/* sum of readers/writers */
@@ -250,19 +353,16 @@ struct m_inode * iget(int dev,int nr)
 
 	if (!dev)
 		panic("iget with dev==0");
-	empty = get_empty_inode();
-	inode = inode_table;
-	while (inode < NR_INODE+inode_table) {
-		if (inode->i_dev != dev || inode->i_num != nr) {
-			inode++;
-			continue;
-		}
+	empty = NULL;
+repeat:
+	if (inode = find_inode(dev,nr)) {
+		if (!inode->i_count++)
+			remove_from_free(inode);
 		wait_on_inode(inode);
 		if (inode->i_dev != dev || inode->i_num != nr) {
-			inode = inode_table;
-			continue;
+			iput(inode);
+			goto repeat;
 		}
-		inode->i_count++;
 		if (inode->i_mount) {
 			int i;
 
@@ -278,18 +378,22 @@ struct m_inode * iget(int dev,int nr)
 			iput(inode);
 			dev = super_block[i].s_dev;
 			nr = ROOT_INO;
-			inode = inode_table;
-			continue;
+			goto repeat;
 		}
 		if (empty)
 			iput(empty);
 		return inode;
 	}
-	if (!empty)
-		return (NULL);
+/* get_empty_inode() may sleep, so we have to look again */
+	if (!empty) {
+		if (!(empty = get_empty_inode()))
+			return (NULL);
+		goto repeat;
+	}
 	inode=empty;
 	inode->i_dev = dev;
 	inode->i_num = nr;
+	insert_inode_hash(inode);
 	read_inode(inode);
 	return inode;
 }
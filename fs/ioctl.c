@@ -43,6 +43,8 @@ int sys_ioctl(unsigned int fd, unsigned int cmd, unsigned long arg)
 	dev = filp->f_inode->i_zone[0];
 	if (MAJOR(dev) >= NRDEVS)
 		return -ENODEV;
+	if (S_ISBLK(mode))
+		return blk_ioctl(dev,cmd,arg);
 	if (!ioctl_table[MAJOR(dev)])
 		return -ENOTTY;
 	return ioctl_table[MAJOR(dev)](dev,cmd,arg);
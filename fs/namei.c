@@ -83,6 +83,173 @@ static int match(int len,const char * name,struct dir_entry * de)
 	return same;
 }
 
+/*
+ * The directory cache remembers the results of name lookups - the
+ * inode number, or 0 if the name isn't there - so that the common
+ * lookups needn't scan the directory. Entries are on a hash queue
+ * by (dev,dir,name) and on an LRU list. Whatever changes a directory
+ * calls dcache_forget() for the name, and a lookup that slept while
+ * something was forgotten doesn't put its (maybe stale) result in.
+ * "." and ".." aren't cached: they are the first entries anyway, and
+ * ".." has its mount-point magic.
+ */
+#define NR_DCACHE	128
+#define NR_DHASH	61
+
+struct dir_cache_entry {
+	unsigned short dev;		/* 0 if unused */
+	unsigned short dir;
+	unsigned short ino;		/* 0 if the name doesn't exist */
+	unsigned short namelen;
+	char name[NAME_LEN];
+	struct dir_cache_entry * next, * prev;		/* hash queue */
+	struct dir_cache_entry * next_lru, * prev_lru;
+};
+
+static struct dir_cache_entry dcache[NR_DCACHE];
+static struct dir_cache_entry * dhash_table[NR_DHASH];
+static struct dir_cache_entry * dcache_lru = NULL;
+static unsigned long dcache_seq = 0;
+
+static inline int dhashfn(int dev, int dir, const char * name, int len)
+{
+	unsigned long h = dev ^ (dir << 4);
+
+	while (len--)
+		h = (h << 1) + *(unsigned char *) name++;
+	return h % NR_DHASH;
+}
+
+static void dcache_init(void)
+{
+	int i;
+
+	for (i = 0 ; i < NR_DCACHE ; i++) {
+		dcache[i].next_lru = dcache + (i+1) % NR_DCACHE;
+		dcache[i].prev_lru = dcache + (i+NR_DCACHE-1) % NR_DCACHE;
+	}
+	dcache_lru = dcache;
+}
+
+static void dcache_unhash(struct dir_cache_entry * dc)
+{
+	if (!dc->dev)
+		return;
+	if (dc->next)
+		dc->next->prev = dc->prev;
+	if (dc->prev)
+		dc->prev->next = dc->next;
+	else
+		dhash_table[dhashfn(dc->dev,dc->dir,dc->name,dc->namelen)] =
+			dc->next;
+	dc->next = dc->prev = NULL;
+	dc->dev = 0;
+}
+
+/* most recently used go last, unused ones first */
+static void dcache_touch(struct dir_cache_entry * dc, int last)
+{
+	if (dc == dcache_lru)
+		dcache_lru = dc->next_lru;
+	dc->prev_lru->next_lru = dc->next_lru;
+	dc->next_lru->prev_lru = dc->prev_lru;
+	dc->next_lru = dcache_lru;
+	dc->prev_lru = dcache_lru->prev_lru;
+	dcache_lru->prev_lru->next_lru = dc;
+	dcache_lru->prev_lru = dc;
+	if (!last)
+		dcache_lru = dc;
+}
+
+static struct dir_cache_entry * dcache_find(int dev, int dir,
+	const char * name, int len)
+{
+	struct dir_cache_entry * dc;
+
+	if (!dcache_lru)
+		return NULL;
+	dc = dhash_table[dhashfn(dev,dir,name,len)];
+	for ( ; dc ; dc = dc->next)
+		if (dc->dev == dev && dc->dir == dir && dc->namelen == len &&
+		    !strncmp(dc->name,name,len))
+			return dc;
+	return NULL;
+}
+
+static void dcache_add(int dev, int dir, const char * name, int len,
+	int ino)
+{
+	struct dir_cache_entry * dc;
+	int h;
+
+	if (!dcache_lru)
+		dcache_init();
+	if (!(dc = dcache_find(dev,dir,name,len))) {
+		dc = dcache_lru;
+		dcache_unhash(dc);
+		dc->dev = dev;
+		dc->dir = dir;
+		dc->namelen = len;
+		strncpy(dc->name,name,len);
+		h = dhashfn(dev,dir,name,len);
+		dc->prev = NULL;
+		if (dc->next = dhash_table[h])
+			dc->next->prev = dc;
+		dhash_table[h] = dc;
+	}
+	dc->ino = ino;
+	dcache_touch(dc,1);
+}
+
+/*
+ * get_name() copies a name from user space, returning 0 if it isn't
+ * one we cache.
+ */
+static int get_name(char * buf, const char * name, int len)
+{
+	int i;
+
+	if (!len || len > NAME_LEN)
+		return 0;
+	for (i = 0 ; i < len ; i++)
+		buf[i] = get_fs_byte(name+i);
+	if (buf[0] == '.' && (len == 1 || (len == 2 && buf[1] == '.')))
+		return 0;
+	return 1;
+}
+
+static void dcache_forget(struct m_inode * dir, const char * name, int len)
+{
+	struct dir_cache_entry * dc;
+	char buf[NAME_LEN];
+
+	dcache_seq++;
+	if (!get_name(buf,name,len))
+		return;
+	if (dc = dcache_find(dir->i_dev,dir->i_num,buf,len)) {
+		dcache_unhash(dc);
+		dcache_touch(dc,0);
+	}
+}
+
+/*
+ * invalidate_dcache() forgets all names in directory 'dir' of 'dev',
+ * or all names on 'dev' if 'dir' is 0.
+ */
+void invalidate_dcache(int dev, int dir)
+{
+	int i;
+
+	dcache_seq++;
+	if (!dcache_lru)
+		return;
+	for (i = 0 ; i < NR_DCACHE ; i++)
+		if (dcache[i].dev == dev && (!dir || dcache[i].dir == dir)) {
+			dcache_unhash(dcache+i);
+			dcache_touch(dcache+i,0);
+		}
+}
+
 /*
  *	find_entry()
  *
@@ -156,6 +323,36 @@ static struct buffer_head * find_entry(struct m_inode ** dir,
 	return NULL;
 }
 
+/*
+ *	lookup_entry()
+ *
+ * returns the inode number of an entry in a directory, or 0 if it
+ * isn't there, using the directory cache if possible.
+ */
+static int lookup_entry(struct m_inode ** dir, const char * name,
+	int namelen)
+{
+	struct dir_cache_entry * dc;
+	struct buffer_head * bh;
+	struct dir_entry * de;
+	char buf[NAME_LEN];
+	unsigned long seq;
+	int inr,cache;
+
+	if (cache = get_name(buf,name,namelen))
+		if (dc = dcache_find((*dir)->i_dev,(*dir)->i_num,buf,namelen)) {
+			dcache_touch(dc,1);
+			return dc->ino;
+		}
+	seq = dcache_seq;
+	bh = find_entry(dir,name,namelen,&de);
+	inr = bh ? de->inode : 0;
+	brelse(bh);
+	if (cache && seq == dcache_seq)
+		dcache_add((*dir)->i_dev,(*dir)->i_num,buf,namelen,inr);
+	return inr;
+}
+
 /*
  *	add_entry()
  *
@@ -213,6 +410,7 @@ static struct buffer_head * add_entry(struct m_inode * dir,
 			for (i=0; i < NAME_LEN ; i++)
 				de->name[i]=(i<namelen)?get_fs_byte(name+i):0;
 			bh->b_dirt = 1;
+			dcache_forget(dir,name,namelen);
 			*res_dir = de;
 			return bh;
 		}
@@ -265,9 +463,7 @@ static struct m_inode * get_dir(const char * pathname, struct m_inode * inode)
 {
 	char c;
 	const char * thisname;
-	struct buffer_head * bh;
 	int namelen,inr;
-	struct dir_entry * de;
 	struct m_inode * dir;
 
 	if (!inode) {
@@ -290,12 +486,10 @@ static struct m_inode * get_dir(const char * pathname, struct m_inode * inode)
 			/* nothing */ ;
 		if (!c)
 			return inode;
-		if (!(bh = find_entry(&inode,thisname,namelen,&de))) {
+		if (!(inr = lookup_entry(&inode,thisname,namelen))) {
 			iput(inode);
 			return NULL;
 		}
-		inr = de->inode;
-		brelse(bh);
 		dir = inode;
 		if (!(inode = iget(dir->i_dev,inr))) {
 			iput(dir);
@@ -336,20 +530,15 @@ struct m_inode * _namei(const char * pathname, struct m_inode * base,
 	const char * basename;
 	int inr,namelen;
 	struct m_inode * inode;
-	struct buffer_head * bh;
-	struct dir_entry * de;
 
 	if (!(base = dir_namei(pathname,&namelen,&basename,base)))
 		return NULL;
 	if (!namelen)			/* special case: '/usr/' etc */
 		return base;
-	bh = find_entry(&base,basename,namelen,&de);
-	if (!bh) {
+	if (!(inr = lookup_entry(&base,basename,namelen))) {
 		iput(base);
 		return NULL;
 	}
-	inr = de->inode;
-	brelse(bh);
 	if (!(inode = iget(base->i_dev,inr))) {
 		iput(base);
 		return NULL;
@@ -408,8 +597,7 @@ int open_namei(const char * pathname, int flag, int mode,
 		iput(dir);
 		return -EISDIR;
 	}
-	bh = find_entry(&dir,basename,namelen,&de);
-	if (!bh) {
+	if (!(inr = lookup_entry(&dir,basename,namelen))) {
 		if (!(flag & O_CREAT)) {
 			iput(dir);
 			return -ENOENT;
@@ -440,9 +628,7 @@ int open_namei(const char * pathname, int flag, int mode,
 		*res_inode = inode;
 		return 0;
 	}
-	inr = de->inode;
 	dev = dir->i_dev;
-	brelse(bh);
 	if (flag & O_EXCL) {
 		iput(dir);
 		return -EEXIST;
@@ -694,6 +880,8 @@ int sys_rmdir(const char * name)
 	if (inode->i_nlinks != 2)
 		printk("empty directory has nlink!=2 (%d)",inode->i_nlinks);
 	de->inode = 0;
+	dcache_forget(dir,basename,namelen);
+	invalidate_dcache(inode->i_dev,inode->i_num);
 	bh->b_dirt = 1;
 	brelse(bh);
 	inode->i_nlinks=0;
@@ -754,6 +942,7 @@ int sys_unlink(const char * name)
 		inode->i_nlinks=1;
 	}
 	de->inode = 0;
+	dcache_forget(dir,basename,namelen);
 	bh->b_dirt = 1;
 	brelse(bh);
 	inode->i_nlinks--;
@@ -208,6 +208,8 @@ int sys_open(const char * filename,int flag,int mode)
 	f->f_count = 1;
 	f->f_inode = inode;
 	f->f_pos = 0;
+	f->f_nextblock = f->f_raend = 0;
+	f->f_rawin = 0;
 	return (fd);
 }
 
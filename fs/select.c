@@ -23,20 +23,16 @@
 
 /*
  * Ok, Peter made a complicated, but straightforward multiple_wait() function.
- * I have rewritten this, taking some shortcuts: This code may not be easy to
- * follow, but it should be free of race-conditions, and it's practical. If you
- * understand what I'm doing here, then you understand how the linux sleep/wakeup
- * mechanism works.
- *
- * Two very simple procedures, add_wait() and free_wait() make all the work. We
- * have to have interrupts disabled throughout the select, but that's not really
- * such a loss: sleeping automatically frees interrupts when we aren't in this
- * task.
+ * With wait queues this is simple: the select table has an entry for each
+ * queue we wait on, add_wait() puts us on the queue, and free_wait() takes
+ * us off all of them again. We have to have interrupts disabled throughout
+ * the select, but that's not really such a loss: sleeping automatically
+ * frees interrupts when we aren't in this task.
  */
 
 typedef struct {
-	struct task_struct * old_task;
-	struct task_struct ** wait_address;
+	struct wait_queue wait;
+	struct wait_queue ** wait_address;
 } wait_entry;
 
 typedef struct {
@@ -44,7 +40,7 @@ typedef struct {
 	wait_entry entry[NR_OPEN*3];
 } select_table;
 
-static void add_wait(struct task_struct ** wait_address, select_table * p)
+static void add_wait(struct wait_queue ** wait_address, select_table * p)
 {
 	int i;
 
@@ -54,28 +50,18 @@ static void add_wait(struct task_struct ** wait_address, select_table * p)
 		if (p->entry[i].wait_address == wait_address)
 			return;
 	p->entry[p->nr].wait_address = wait_address;
-	p->entry[p->nr].old_task = * wait_address;
-	*wait_address = current;
+	p->entry[p->nr].wait.task = current;
+	p->entry[p->nr].wait.exclusive = 0;
+	add_wait_queue(wait_address,&p->entry[p->nr].wait);
 	p->nr++;
 }
 
 static void free_wait(select_table * p)
 {
 	int i;
-	struct task_struct ** tpp;
 
-	for (i = 0; i < p->nr ; i++) {
-		tpp = p->entry[i].wait_address;
-		while (*tpp && *tpp != current) {
-			(*tpp)->state = 0;
-			current->state = TASK_UNINTERRUPTIBLE;
-			schedule();
-		}
-		if (!*tpp)
-			printk("free_wait: NULL");
-		if (*tpp = p->entry[i].old_task)
-			(**tpp).state = 0;
-	}
+	for (i = 0; i < p->nr ; i++)
+		remove_wait_queue(p->entry[i].wait_address,&p->entry[i].wait);
 	p->nr = 0;
 }
 
@@ -154,8 +140,9 @@ static int check_ex(select_table * wait, struct m_inode * inode)
 int do_select(fd_set in, fd_set out, fd_set ex,
 	fd_set *inp, fd_set *outp, fd_set *exp)
 {
+	static struct kmem_cache * select_cachep = NULL;
 	int count;
-	select_table wait_table;
+	select_table * wait_table;
 	int i;
 	fd_set mask;
 
@@ -175,36 +162,43 @@ int do_select(fd_set in, fd_set out, fd_set ex,
 			continue;
 		return -EBADF;
 	}
+/* keep the wait table off the kernel stack */
+	if (!select_cachep && !(select_cachep = kmem_cache_create(
+	    "select_table",sizeof(select_table),NULL)))
+		return -ENOMEM;
+	if (!(wait_table = (select_table *) kmem_cache_alloc(select_cachep)))
+		return -ENOMEM;
 repeat:
-	wait_table.nr = 0;
+	wait_table->nr = 0;
 	*inp = *outp = *exp = 0;
 	count = 0;
 	mask = 1;
 	for (i = 0 ; i < NR_OPEN ; i++, mask += mask) {
 		if (mask & in)
-			if (check_in(&wait_table,current->filp[i]->f_inode)) {
+			if (check_in(wait_table,current->filp[i]->f_inode)) {
 				*inp |= mask;
 				count++;
 			}
 		if (mask & out)
-			if (check_out(&wait_table,current->filp[i]->f_inode)) {
+			if (check_out(wait_table,current->filp[i]->f_inode)) {
 				*outp |= mask;
 				count++;
 			}
 		if (mask & ex)
-			if (check_ex(&wait_table,current->filp[i]->f_inode)) {
+			if (check_ex(wait_table,current->filp[i]->f_inode)) {
 				*exp |= mask;
 				count++;
 			}
 	}
 	if (!(current->signal & ~current->blocked) &&
-	    (wait_table.nr || current->timeout) && !count) {
+	    (wait_table->nr || current->timeout) && !count) {
 		current->state = TASK_INTERRUPTIBLE;
 		schedule();
-		free_wait(&wait_table);
+		free_wait(wait_table);
 		goto repeat;
 	}
-	free_wait(&wait_table);
+	free_wait(wait_table);
+	kmem_cache_free(select_cachep,wait_table);
 	return count;
 }
 
@@ -32,7 +32,7 @@ static void lock_super(struct super_block * sb)
 {
 	cli();
 	while (sb->s_lock)
-		sleep_on(&(sb->s_wait));
+		sleep_on_exclusive(&(sb->s_wait));
 	sb->s_lock = 1;
 	sti();
 }
@@ -193,6 +193,7 @@ int sys_umount(char * dev_name)
 	sb->s_isup = NULL;
 	put_super(dev);
 	sync_dev(dev);
+	invalidate_dcache(dev,0);
 	return 0;
 }
 
@@ -17,6 +17,12 @@ __asm__ ("movl %%esp,%%eax\n\t" \
 #define cli() __asm__ ("cli"::)
 #define nop() __asm__ ("nop"::)
 
+#define save_flags(x) \
+__asm__ __volatile__("pushfl ; popl %0":"=r" (x)::"memory")
+
+#define restore_flags(x) \
+__asm__ __volatile__("pushl %0 ; popfl"::"r" (x):"memory")
+
 #define iret() __asm__ ("iret"::)
 
 #define _set_gate(gate_addr,type,dpl,addr) \
@@ -7,6 +7,7 @@
 #define _FS_H
 
 #include <sys/types.h>
+#include <linux/wait.h>
 
 /* devices are as follows: (same as minix, so we can use the minix
  * file system. These are major numbers.)
@@ -29,6 +30,7 @@
 #define WRITEA 3	/* "write-ahead" - silly, but somewhat useful */
 
 void buffer_init(long buffer_end);
+void inode_init(void);
 
 #define MAJOR(a) (((unsigned)(a))>>8)
 #define MINOR(a) ((a)&0xff)
@@ -41,10 +43,12 @@ void buffer_init(long buffer_end);
 #define SUPER_MAGIC 0x137F
 
 #define NR_OPEN 20
-#define NR_INODE 64
+#define NR_INODE 256
 #define NR_FILE 64
 #define NR_SUPER 8
 #define NR_HASH 307
+#define NR_DEVHASH 31
+#define NR_IHASH 131
 #define NR_BUFFERS nr_buffers
 #define BLOCK_SIZE 1024
 #define BLOCK_SIZE_BITS 10
@@ -63,6 +67,25 @@ void buffer_init(long buffer_end);
 #define PIPE_EMPTY(inode) (PIPE_HEAD(inode)==PIPE_TAIL(inode))
 #define PIPE_FULL(inode) (PIPE_SIZE(inode)==(PAGE_SIZE-1))
 
+/* block device ioctls, and the i/o schedulers they select */
+#define BLKGETSCHED	0x1201
+#define BLKSETSCHED	0x1202
+#define BLKGETQSTAT	0x1203
+#define BLKSETQMAX	0x1204
+
+#define IOSCHED_CLASSIC		0
+#define IOSCHED_DEADLINE	1
+#define NR_IOSCHED		2
+
+/* request pool statistics of a major, as returned by BLKGETQSTAT */
+struct blk_qstat {
+	int nr_requests;	/* current size of the request pool */
+	int max_requests;	/* how far the pool may grow */
+	int in_use;
+	int max_in_use;		/* high-water mark of in_use */
+	int nr_waits;		/* times somebody had to wait for a request */
+};
+
 #define NIL_FILP	((struct file *)0)
 #define SEL_IN		1
 #define SEL_OUT		2
@@ -78,11 +101,16 @@ struct buffer_head {
 	unsigned char b_dirt;		/* 0-clean,1-dirty */
 	unsigned char b_count;		/* users using this block */
 	unsigned char b_lock;		/* 0 - ok, 1 -locked */
-	struct task_struct * b_wait;
+	unsigned char b_list;		/* lru-list we are on (clean/dirty) */
+	unsigned long b_flushtime;	/* when a dirty buffer should be written */
+	struct wait_queue * b_wait;
 	struct buffer_head * b_prev;
 	struct buffer_head * b_next;
 	struct buffer_head * b_prev_free;
 	struct buffer_head * b_next_free;
+	struct buffer_head * b_prev_dev;	/* buffers of the same device */
+	struct buffer_head * b_next_dev;
+	struct buffer_head * b_reqnext;	/* next buffer in the same request */
 };
 
 struct d_inode {
@@ -104,8 +132,8 @@ struct m_inode {
 	unsigned char i_nlinks;
 	unsigned short i_zone[9];
 /* these are in memory also */
-	struct task_struct * i_wait;
-	struct task_struct * i_wait2;	/* for pipes */
+	struct wait_queue * i_wait;
+	struct wait_queue * i_wait2;	/* for pipes */
 	unsigned long i_atime;
 	unsigned long i_ctime;
 	unsigned short i_dev;
@@ -117,6 +145,11 @@ struct m_inode {
 	unsigned char i_mount;
 	unsigned char i_seek;
 	unsigned char i_update;
+	unsigned short i_pages;		/* in the page cache */
+	struct m_inode * i_next;	/* hash queue */
+	struct m_inode * i_prev;
+	struct m_inode * i_next_free;	/* unused inodes, see inode.c */
+	struct m_inode * i_prev_free;
 };
 
 struct file {
@@ -125,6 +158,10 @@ struct file {
 	unsigned short f_count;
 	struct m_inode * f_inode;
 	off_t f_pos;
+/* readahead state for file_read() */
+	unsigned long f_nextblock;	/* where a sequential read goes on */
+	unsigned long f_raend;		/* first block not read ahead yet */
+	unsigned short f_rawin;		/* window size, in blocks */
 };
 
 struct super_block {
@@ -143,7 +180,7 @@ struct super_block {
 	struct m_inode * s_isup;
 	struct m_inode * s_imount;
 	unsigned long s_time;
-	struct task_struct * s_wait;
+	struct wait_queue * s_wait;
 	unsigned char s_lock;
 	unsigned char s_rd_only;
 	unsigned char s_dirt;
@@ -183,20 +220,26 @@ extern int bmap(struct m_inode * inode,int block);
 extern int create_block(struct m_inode * inode,int block);
 extern struct m_inode * namei(const char * pathname);
 extern struct m_inode * lnamei(const char * pathname);
+extern void invalidate_dcache(int dev, int dir);
 extern int open_namei(const char * pathname, int flag, int mode,
 	struct m_inode ** res_inode);
 extern void iput(struct m_inode * inode);
 extern struct m_inode * iget(int dev,int nr);
 extern struct m_inode * get_empty_inode(void);
 extern struct m_inode * get_pipe_inode(void);
+extern void insert_inode_hash(struct m_inode * inode);
+extern void clear_inode(struct m_inode * inode);
 extern struct buffer_head * get_hash_table(int dev, int block);
 extern struct buffer_head * getblk(int dev, int block);
 extern void ll_rw_block(int rw, struct buffer_head * bh);
 extern void ll_rw_page(int rw, int dev, int nr, char * buffer);
+extern void ll_rw_chain(int rw, struct buffer_head * bh);
+extern int blk_ioctl(int dev, int cmd, int arg);
 extern void brelse(struct buffer_head * buf);
 extern struct buffer_head * bread(int dev,int block);
 extern void bread_page(unsigned long addr,int dev,int b[4]);
 extern struct buffer_head * breada(int dev,int block,...);
+extern void bread_ahead(int dev,int block);
 extern int new_block(int dev);
 extern int free_block(int dev, int block);
 extern struct m_inode * new_inode(int dev);
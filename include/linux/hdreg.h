@@ -40,6 +40,12 @@
 #define WIN_SEEK 		0x70
 #define WIN_DIAGNOSE		0x90
 #define WIN_SPECIFY		0x91
+#define WIN_MULTREAD		0xC4	/* read sectors using multiple mode */
+#define WIN_MULTWRITE		0xC5	/* write sectors using multiple mode */
+#define WIN_SETMULT		0xC6	/* enable/disable multiple mode */
+#define WIN_READDMA		0xC8	/* read sectors using bus-master DMA */
+#define WIN_WRITEDMA		0xCA	/* write sectors using bus-master DMA */
+#define WIN_IDENTIFY		0xEC	/* ask drive to identify itself */
 
 /* Bits for HD_ERROR */
 #define MARK_ERR	0x01	/* Bad address mark ? */
@@ -49,6 +55,24 @@
 #define ECC_ERR		0x40	/* ? */
 #define	BBD_ERR		0x80	/* ? */
 
+/*
+ * Bus-master ide registers (PIIX and compatibles), relative to the
+ * i/o base in PCI BAR 4. These are for the primary channel.
+ */
+#define BM_COMMAND	0
+#define BM_STATUS	2
+#define BM_PRD		4	/* physical address of the PRD table */
+
+/* Bits for BM_COMMAND */
+#define BM_START	0x01
+#define BM_READ		0x08	/* transfer is to memory */
+
+/* Bits for BM_STATUS */
+#define BM_ACTIVE	0x01
+#define BM_ERROR	0x02	/* write 1 to clear */
+#define BM_INTR		0x04	/* write 1 to clear */
+#define BM_DRV0_DMA	0x20	/* drive 0 is set up for DMA */
+
 struct partition {
 	unsigned char boot_ind;		/* 0x80 - active (unused) */
 	unsigned char head;		/* ? */
@@ -10,6 +10,14 @@ void console_print(const char * str);
 int tty_write(unsigned ch,char * buf,int count);
 void * malloc(unsigned int size);
 void free_s(void * obj, int size);
+void malloc_show(void);
+struct kmem_cache;
+struct kmem_cache * kmem_cache_create(const char * name, int size,
+	void (*ctor)(void *));
+void * kmem_cache_alloc(struct kmem_cache * cachep);
+void kmem_cache_free(struct kmem_cache * cachep, void * obj);
+int kmem_cache_shrink(void);
+void kmem_cache_show(void);
 extern void hd_times_out(void);
 extern void sysbeepstop(void);
 extern void blank_screen(void);
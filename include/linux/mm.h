@@ -8,14 +8,50 @@
 
 extern int SWAP_DEV;
 
-#define read_swap_page(nr,buffer) ll_rw_page(READ,SWAP_DEV,(nr),(buffer));
-#define write_swap_page(nr,buffer) ll_rw_page(WRITE,SWAP_DEV,(nr),(buffer));
-
 extern unsigned long get_free_page(void);
+extern unsigned long get_free_pages(int order);
+extern unsigned long __get_free_pages(int order);
 extern unsigned long put_dirty_page(unsigned long page,unsigned long address);
 extern void free_page(unsigned long addr);
-void swap_free(int page_nr);
+extern void free_pages(unsigned long addr, int order);
+void swap_free(unsigned long entry);
 void swap_in(unsigned long *table_ptr);
+extern void add_rss(unsigned long addr, int nr);
+extern int unshare_table(unsigned long address);
+extern void zap_page_range(unsigned long from, unsigned long size);
+
+struct m_inode;
+extern unsigned long find_page_cache(struct m_inode * inode,
+	unsigned long block);
+extern int add_page_cache(struct m_inode * inode, unsigned long block,
+	unsigned long page);
+extern unsigned long find_block_page(struct m_inode * inode,
+	unsigned long block, int * offset);
+extern int page_cache_holds(struct m_inode * inode, unsigned long block,
+	unsigned long page);
+extern void update_page_cache(struct m_inode * inode, unsigned long block,
+	int offset, char * data, int count);
+extern void invalidate_inode_pages(struct m_inode * inode);
+extern int shrink_page_cache(void);
+
+/*
+ * The areas a process has mmap()ed, on a list sorted by address. The
+ * addresses are relative to the start of the process' segment.
+ */
+struct vm_area_struct {
+	unsigned long vm_start, vm_end;
+	unsigned long vm_offset;	/* of vm_start in the file */
+	struct m_inode * vm_inode;	/* NULL for anonymous memory */
+	unsigned short vm_prot, vm_flags;
+	struct vm_area_struct * vm_next;
+};
+
+struct task_struct;
+extern struct vm_area_struct * find_vma(struct task_struct * p,
+	unsigned long addr);
+extern int copy_mmap(struct task_struct * p);
+extern void free_mmap(struct task_struct * p);
+extern void exit_mmap(void);
 
 extern inline volatile void oom(void)
 {
@@ -36,6 +72,16 @@ extern unsigned long HIGH_MEMORY;
 
 extern unsigned char mem_map [ PAGING_PAGES ];
 
+/*
+ * Free memory is kept in blocks of 2^order pages (a buddy system, see
+ * memory.c), on one list per order, so that allocating and freeing
+ * take constant time. mem_map[] still holds the use count of every
+ * page: a block of several pages is counted in its first one.
+ */
+#define NR_MEM_LISTS 6
+
+extern int nr_free_pages;
+
 #define PAGE_DIRTY	0x40
 #define PAGE_ACCESSED	0x20
 #define PAGE_USER	0x04
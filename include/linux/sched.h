@@ -25,6 +25,10 @@
 
 #define LIBRARY_OFFSET (TASK_SIZE - LIBRARY_SIZE)
 
+/* mmap() puts its areas here: above brk, below the room for the stack */
+#define MMAP_START (TASK_SIZE/4)
+#define MMAP_END (LIBRARY_OFFSET - 0x800000)
+
 #define CT_TO_SECS(x)	((x) / HZ)
 #define CT_TO_USECS(x)	(((x) % HZ) * 1000000/HZ)
 
@@ -34,6 +38,7 @@
 #include <linux/head.h>
 #include <linux/fs.h>
 #include <linux/mm.h>
+#include <linux/timer.h>
 #include <sys/param.h>
 #include <sys/time.h>
 #include <sys/resource.h>
@@ -99,6 +104,7 @@ struct tss_struct {
 	long	gs;		/* 16 high bits zero */
 	long	ldt;		/* 16 high bits zero */
 	long	trace_bitmap;	/* bits: trace 0, bitmap 16-31 */
+	long	tr;		/* not in the hardware TSS: its selector */
 	struct i387_struct i387;
 };
 
@@ -128,6 +134,19 @@ struct task_struct {
 	struct rlimit rlim[RLIM_NLIMITS]; 
 	unsigned int flags;	/* per process flags, defined below */
 	unsigned short used_math;
+/* run queue links, see sched.c */
+	struct task_struct *next_run, *prev_run;
+	struct timer_list real_timer;	/* for alarm() */
+	unsigned long epoch;
+	int runq;
+/* memory usage: resident pages, faults and pages swapped out */
+	unsigned long rss,max_rss;
+	unsigned long min_flt,maj_flt,nswap;
+	unsigned long cmin_flt,cmaj_flt,cnswap;
+/* a vfork() parent sleeps here until we exec or exit */
+	struct wait_queue * vfork_wait;
+/* mmap()ed areas, see mm/mmap.c */
+	struct vm_area_struct * mmap;
 /* file system info */
 	int tty;		/* -1 if no tty, so it must be signed */
 	unsigned short umask;
@@ -148,6 +167,7 @@ struct task_struct {
  */
 #define PF_ALIGNWARN	0x00000001	/* Print alignment warning msgs */
 					/* Not implemented yet, only for 486*/
+#define PF_VFORK	0x00000002	/* parent waits in vfork() */
 
 /*
  *  INIT_TASK is used to set up the first task table, touch at
@@ -167,6 +187,10 @@ struct task_struct {
 		  {0x7fffffff, 0x7fffffff}, {0x7fffffff, 0x7fffffff}}, \
 /* flags */	0, \
 /* math */	0, \
+/* run queue */	NULL,NULL,{NULL,NULL,0,0,NULL},0,0, \
+/* mm stats */	0,0,0,0,0,0,0,0, \
+/* vfork */	NULL, \
+/* mmap */	NULL, \
 /* fs info */	-1,0022,NULL,NULL,NULL,NULL,0, \
 /* filp */	{NULL,}, \
 	{ \
@@ -177,12 +201,18 @@ struct task_struct {
 /*tss*/	{0,PAGE_SIZE+(long)&init_task,0x10,0,0,0,0,(long)&pg_dir,\
 	 0,0,0,0,0,0,0,0, \
 	 0,0,0x17,0x17,0x17,0x17,0x17,0x17, \
-	 _LDT(0),0x80000000, \
+	 _LDT(0),0x80000000,_TSS(0), \
 		{} \
 	}, \
 }
 
 extern struct task_struct *task[NR_TASKS];
+
+/*
+ * The task owning a linear address: each task has a TASK_SIZE slot.
+ * NULL for a free slot (or one whose task is still being set up).
+ */
+#define ADDR_TASK(addr) (task[(unsigned long) (addr) / TASK_SIZE])
 extern struct task_struct *last_task_used_math;
 extern struct task_struct *current;
 extern unsigned long volatile jiffies;
@@ -191,10 +221,12 @@ extern int jiffies_offset;
 
 #define CURRENT_TIME (startup_time+(jiffies+jiffies_offset)/HZ)
 
-extern void add_timer(long jiffies, void (*fn)(void));
-extern void sleep_on(struct task_struct ** p);
-extern void interruptible_sleep_on(struct task_struct ** p);
-extern void wake_up(struct task_struct ** p);
+extern void sleep_on(struct wait_queue ** p);
+extern void interruptible_sleep_on(struct wait_queue ** p);
+extern void sleep_on_exclusive(struct wait_queue ** p);
+extern void wake_up_process(struct task_struct * p);
+extern void signal_wake_up(struct task_struct * p);
+extern void vfork_done(void);
 extern int in_group_p(gid_t grp);
 
 /*
@@ -214,12 +246,12 @@ __asm__("str %%ax\n\t" \
 	:"=a" (n) \
 	:"a" (0),"i" (FIRST_TSS_ENTRY<<3))
 /*
- *	switch_to(n) should switch tasks to task nr n, first
- * checking that n isn't the current task, in which case it does nothing.
+ *	switch_to(tsk) should switch tasks to task tsk, first
+ * checking that tsk isn't the current task, in which case it does nothing.
  * This also clears the TS-flag if the task we switched to has used
  * tha math co-processor latest.
  */
-#define switch_to(n) {\
+#define switch_to(tsk) {\
 struct {long a,b;} __tmp; \
 __asm__("cmpl %%ecx,_current\n\t" \
 	"je 1f\n\t" \
@@ -231,7 +263,7 @@ __asm__("cmpl %%ecx,_current\n\t" \
 	"clts\n" \
 	"1:" \
 	::"m" (*&__tmp.a),"m" (*&__tmp.b), \
-	"d" (_TSS(n)),"c" ((long) task[n])); \
+	"d" ((tsk)->tss.tr),"c" ((long) (tsk))); \
 }
 
 #define PAGE_ALIGN(n) (((n)+0xfff)&0xfffff000)
@@ -0,0 +1,26 @@
+#ifndef _TIMER_H
+#define _TIMER_H
+
+/*
+ * Kernel timers. The caller owns the timer_list, and sets 'expires' (in
+ * jiffies), 'function' and 'data' before add_timer(): the function is
+ * then called with 'data' from the timer interrupt, with interrupts off,
+ * once jiffies has got to 'expires'. A timer can be added again from
+ * its own function. del_timer() returns 1 if the timer was pending.
+ *
+ * Adding a timer that is pending already just moves it.
+ */
+struct timer_list {
+	struct timer_list * next;	/* must be first, see sched.c */
+	struct timer_list * prev;
+	unsigned long expires;
+	unsigned long data;
+	void (*function)(unsigned long);
+};
+
+#define init_timer(timer) ((timer)->next = (timer)->prev = NULL)
+
+extern void add_timer(struct timer_list * timer);
+extern int del_timer(struct timer_list * timer);
+
+#endif
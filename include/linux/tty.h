@@ -16,14 +16,20 @@
 extern int NR_CONSOLES;
 
 #include <termios.h>
+#include <linux/wait.h>
 
 #define TTY_BUF_SIZE 1024
 
+/*
+ * NOTE! rs_io.s and keyboard.S know the layout of this (see tty_init()).
+ * proc_list is a wait queue: the interrupt code must only ever hand its
+ * address to __wake_up(), never touch what it points to.
+ */
 struct tty_queue {
 	unsigned long data;
 	unsigned long head;
 	unsigned long tail;
-	struct task_struct * proc_list;
+	struct wait_queue * proc_list;
 	char buf[TTY_BUF_SIZE];
 };
 
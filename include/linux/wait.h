@@ -0,0 +1,27 @@
+#ifndef _WAIT_H
+#define _WAIT_H
+
+/*
+ * A wait queue is a list of the tasks sleeping on something, each with
+ * an entry of its own (usually on its kernel stack). Non-exclusive
+ * waiters are at the front and are all woken up by wake_up(); exclusive
+ * waiters queue up behind them, and wake_up() only wakes the first of
+ * those that isn't awake already - for things like locks, where only
+ * one of them can get on anyway. wake_up_all() wakes everybody.
+ */
+struct task_struct;
+
+struct wait_queue {
+	struct task_struct * task;
+	struct wait_queue * next;
+	int exclusive;
+};
+
+extern void add_wait_queue(struct wait_queue ** p, struct wait_queue * wait);
+extern void remove_wait_queue(struct wait_queue ** p, struct wait_queue * wait);
+extern void __wake_up(struct wait_queue ** p, int nr_exclusive);
+
+#define wake_up(p) __wake_up((p),1)
+#define wake_up_all(p) __wake_up((p),0)
+
+#endif
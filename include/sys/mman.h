@@ -0,0 +1,22 @@
+#ifndef _SYS_MMAN_H
+#define _SYS_MMAN_H
+
+#include <sys/types.h>
+
+#define PROT_NONE	0
+#define PROT_READ	1
+#define PROT_WRITE	2
+#define PROT_EXEC	4
+
+#define MAP_SHARED	0x01	/* changes go back to the file */
+#define MAP_PRIVATE	0x02	/* changes are private */
+#define MAP_TYPE	0x0f
+#define MAP_FIXED	0x10	/* map at exactly 'addr' */
+#define MAP_ANONYMOUS	0x20	/* zero-filled memory, no file */
+
+#define MAP_FAILED	((void *) -1)
+
+void * mmap(void * addr, size_t len, int prot, int flags, int fildes, off_t off);
+int munmap(void * addr, size_t len);
+
+#endif
@@ -24,6 +24,10 @@
 #define W_OK	2
 #define R_OK	4
 
+/* swapon */
+#define SWAP_FLAG_PREFER	0x8000	/* use the priority in the low bits */
+#define SWAP_FLAG_PRIO_MASK	0x7fff
+
 /* lseek */
 #define SEEK_SET	0
 #define SEEK_CUR	1
@@ -146,6 +150,12 @@
 #define __NR_lstat	84
 #define __NR_readlink	85
 #define __NR_uselib	86
+#define __NR_bdflush	87
+#define __NR_swapon	88
+#define __NR_swapoff	89
+#define __NR_vfork	90
+#define __NR_mmap	91
+#define __NR_munmap	92
 
 #define _syscall0(type,name) \
 type name(void) \
@@ -249,6 +259,8 @@ void (*signal(int sig, void (*fn)(int)))(int);
 int stat(const char * filename, struct stat * stat_buf);
 int fstat(int fildes, struct stat * stat_buf);
 int stime(time_t * tptr);
+int swapoff(const char * specialfile);
+int swapon(const char * specialfile, int swap_flags);
 int sync(void);
 time_t time(time_t * tloc);
 time_t times(struct tms * tbuf);
@@ -259,6 +271,7 @@ int uname(struct utsname * name);
 int unlink(const char * filename);
 int ustat(dev_t dev, struct ustat * ubuf);
 int utime(const char * filename, struct utimbuf * times);
+int vfork(void);
 pid_t waitpid(pid_t pid,int * wait_stat,int options);
 pid_t wait(int * wait_stat);
 int write(int fildes, const char * buf, off_t count);
@@ -24,6 +24,7 @@ static inline _syscall0(int,fork)
 static inline _syscall0(int,pause)
 static inline _syscall1(int,setup,void *,BIOS)
 static inline _syscall0(int,sync)
+static inline _syscall2(int,bdflush,int,func,long,data)
 
 #include <linux/tty.h>
 #include <linux/sched.h>
@@ -158,6 +159,7 @@ void main(void)		/* This really IS void, no error here. */
 	time_init();
 	sched_init();
 	buffer_init(buffer_memory_end);
+	inode_init();
 	hd_init();
 	floppy_init();
 	sti();
@@ -198,6 +200,12 @@ void init(void)
 	printf("%d buffers = %d bytes buffer space\n\r",NR_BUFFERS,
 		NR_BUFFERS*BLOCK_SIZE);
 	printf("Free mem: %d bytes\n\r",memory_end-main_memory_start);
+	if (!(pid=fork())) {
+		close(0);close(1);close(2);
+		setsid();
+		(void) bdflush(0,0);	/* only returns on a signal */
+		_exit(0);
+	}
 	if (!(pid=fork())) {
 		close(0);
 		if (open("/etc/rc",O_RDONLY,0))
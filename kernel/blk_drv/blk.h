@@ -3,7 +3,8 @@
 
 #define NR_BLK_DEV	7
 /*
- * NR_REQUEST is the number of entries in the request-queue.
+ * NR_REQUEST is the number of entries in the request-queue of the
+ * hard-disk at boot, the other devices start with half of that.
  * NOTE that writes may use only the low 2/3 of these: reads
  * take precedence.
  *
@@ -11,14 +12,35 @@
  * from the elevator-mechanism, but not so much as to lock a lot of
  * buffers when they are in the queue. 64 seems to be too many (easily
  * long pauses in reading when heavy writing/syncing is going on)
+ *
+ * Every major has a pool of its own, so one device can't starve
+ * another. A pool that runs dry grows by REQUEST_GROW requests at a
+ * time (taken from free pages), up to MAX_REQUEST unless changed with
+ * BLKSETQMAX. BLKGETQSTAT tells how deep the queue really gets.
  */
 #define NR_REQUEST	32
+#define REQUEST_GROW	8
+#define MAX_REQUEST	(4*NR_REQUEST)
+#define MAX_REQUEST_LIMIT 1024
+
+/*
+ * MAX_SECTORS limits how big a request may grow when adjacent blocks
+ * are merged into it. It has to fit the 8-bit sector count of the
+ * hd controller.
+ */
+#define MAX_SECTORS	254
 
 /*
  * Ok, this is an expanded form so that we can use the same
  * request for paging requests when that is implemented. In
  * paging, 'bh' is NULL, and 'waiting' is used to wait for
  * read/write completion.
+ *
+ * A request for buffers may contain several blocks that follow each
+ * other on the disk: they are chained through b_reqnext, from 'bh' to
+ * 'bhtail'. 'buffer' and 'current_nr_sectors' always refer to the
+ * first buffer of the chain, 'sector' and 'nr_sectors' to the whole
+ * remaining run. end_request() moves on to the next buffer.
  */
 struct request {
 	int dev;		/* -1 if no request */
@@ -26,9 +48,12 @@ struct request {
 	int errors;
 	unsigned long sector;
 	unsigned long nr_sectors;
+	unsigned long current_nr_sectors;
+	unsigned long deadline;	/* used by the deadline scheduler */
 	char * buffer;
 	struct task_struct * waiting;
 	struct buffer_head * bh;
+	struct buffer_head * bhtail;
 	struct request * next;
 };
 
@@ -42,14 +67,38 @@ struct request {
 ((s1)->dev < (s2)->dev || ((s1)->dev == (s2)->dev && \
 (s1)->sector < (s2)->sector)))
 
+struct blk_dev_struct;
+
+/*
+ * An i/o scheduler decides in what order the requests of a major are
+ * done. 'insert' puts a new request on the queue (always behind the
+ * current one), 'next' is called from end_request() - ie from the
+ * interrupt - to choose the request to do after 'req', and 'merge'
+ * may add a buffer to an already queued request (returning 1 if it
+ * did). The scheduler of a major can be changed with BLKSETSCHED.
+ */
+struct blk_sched {
+	char * name;
+	void (*insert)(struct blk_dev_struct * dev, struct request * req);
+	struct request * (*next)(struct request * req);
+	int (*merge)(struct blk_dev_struct * dev, int rw,
+		struct buffer_head * bh);
+};
+
 struct blk_dev_struct {
 	void (*request_fn)(void);
 	struct request * current_request;
+	struct blk_sched * sched;
+/* the request pool of this major */
+	struct request * free_request;
+	struct wait_queue * wait_for_request;
+	int nr_requests, max_requests;
+	int in_use, max_in_use;
+	int nr_waits;
 };
 
+extern struct blk_sched blk_sched[NR_IOSCHED];
 extern struct blk_dev_struct blk_dev[NR_BLK_DEV];
-extern struct request request[NR_REQUEST];
-extern struct task_struct * wait_for_request;
 
 extern int * blk_size[NR_BLK_DEV];
 
@@ -115,22 +164,47 @@ extern inline void unlock_buffer(struct buffer_head * bh)
 	wake_up(&bh->b_wait);
 }
 
+/*
+ * end_request() finishes the first buffer of the current request. If
+ * there are more buffers chained to it, the request is set up for the
+ * next one and stays current: the driver just carries on with it.
+ */
 extern inline void end_request(int uptodate)
 {
-	DEVICE_OFF(CURRENT->dev);
-	if (CURRENT->bh) {
-		CURRENT->bh->b_uptodate = uptodate;
-		unlock_buffer(CURRENT->bh);
-	}
+	struct buffer_head * bh;
+	struct request * req;
+
 	if (!uptodate) {
 		printk(DEVICE_NAME " I/O error\n\r");
 		printk("dev %04x, block %d\n\r",CURRENT->dev,
-			CURRENT->bh->b_blocknr);
+			CURRENT->bh ? CURRENT->bh->b_blocknr :
+			CURRENT->sector>>1);
 	}
-	wake_up(&CURRENT->waiting);
-	wake_up(&wait_for_request);
-	CURRENT->dev = -1;
-	CURRENT = CURRENT->next;
+	if (bh = CURRENT->bh) {
+		CURRENT->bh = bh->b_reqnext;
+		bh->b_reqnext = NULL;
+		bh->b_uptodate = uptodate;
+		unlock_buffer(bh);
+		if (bh = CURRENT->bh) {
+			CURRENT->errors = 0;
+			CURRENT->sector = bh->b_blocknr<<1;
+			CURRENT->nr_sectors =
+				(CURRENT->bhtail->b_blocknr-bh->b_blocknr+1)<<1;
+			CURRENT->current_nr_sectors = 2;
+			CURRENT->buffer = bh->b_data;
+			return;
+		}
+	}
+	DEVICE_OFF(CURRENT->dev);
+	if (CURRENT->waiting)
+		wake_up_process(CURRENT->waiting);
+	wake_up(&blk_dev[MAJOR_NR].wait_for_request);
+	req = CURRENT;
+	req->dev = -1;
+	CURRENT = (blk_dev[MAJOR_NR].sched->next)(req);
+	req->next = blk_dev[MAJOR_NR].free_request;
+	blk_dev[MAJOR_NR].free_request = req;
+	blk_dev[MAJOR_NR].in_use--;
 }
 
 #ifdef DEVICE_TIMEOUT
@@ -121,7 +121,7 @@ static unsigned char seek_track = 0;
 static unsigned char current_track = 255;
 static unsigned char command = 0;
 unsigned char selected = 0;
-struct task_struct * wait_on_floppy_select = NULL;
+struct wait_queue * wait_on_floppy_select = NULL;
 
 void floppy_deselect(unsigned int nr)
 {
@@ -307,7 +307,7 @@ static void seek_interrupt(void)
  * for the transfer (ie floppy motor is on and the correct floppy is
  * selected).
  */
-static void transfer(void)
+static void transfer(unsigned long unused)
 {
 	if (cur_spec1 != floppy->spec1) {
 		cur_spec1 = floppy->spec1;
@@ -402,7 +402,9 @@ static void reset_floppy(void)
 	sti();
 }
 
-static void floppy_on_interrupt(void)
+static struct timer_list fd_timer = { NULL, NULL, 0, 0, NULL };
+
+static void floppy_on_interrupt(unsigned long unused)
 {
 /* We cannot do a floppy-select, as that might sleep. We just force it */
 	selected = 1;
@@ -410,9 +412,11 @@ static void floppy_on_interrupt(void)
 		current_DOR &= 0xFC;
 		current_DOR |= current_drive;
 		outb(current_DOR,FD_DOR);
-		add_timer(2,&transfer);
+		fd_timer.expires = jiffies + 2;
+		fd_timer.function = transfer;
+		add_timer(&fd_timer);
 	} else
-		transfer();
+		transfer(0);
 }
 
 void do_fd_request(void)
@@ -452,7 +456,9 @@ void do_fd_request(void)
 		command = FD_WRITE;
 	else
 		panic("do_fd_request: unknown command");
-	add_timer(ticks_to_floppy_on(current_drive),&floppy_on_interrupt);
+	fd_timer.expires = jiffies + ticks_to_floppy_on(current_drive);
+	fd_timer.function = floppy_on_interrupt;
+	add_timer(&fd_timer);
 }
 
 static int floppy_sizes[] ={
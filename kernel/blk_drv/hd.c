@@ -33,9 +33,13 @@ inb_p(0x71); \
 /* Max read/write errors/sector */
 #define MAX_ERRORS	7
 #define MAX_HD		2
+/* Max sectors per interrupt we use in multiple mode */
+#define MAX_MULT	16
 
 static void recal_intr(void);
 static void bad_rw_intr(void);
+static int hd_identify(int drive);
+static void dma_intr(void);
 
 static int recalibrate = 0;
 static int reset = 0;
@@ -61,11 +65,52 @@ static struct hd_struct {
 
 static int hd_sizes[5*MAX_HD] = {0, };
 
+/*
+ * What the drives told us they can do (see hd_identify()): the number
+ * of sectors per interrupt in multiple mode (0 if we don't use it), and
+ * whether the data port may be read and written 32 bits at a time.
+ */
+static int hd_mult[MAX_HD] = {0, };
+static int hd_io32[MAX_HD] = {0, };
+
+/*
+ * mult_count is the number of sectors the drive transfers per interrupt
+ * for the command in progress, block_count the number of sectors we
+ * last gave it in write_block().
+ */
+static int mult_count = 1;
+static int block_count = 0;
+
+/*
+ * Bus-master DMA. hd_init() looks for a PCI ide controller that can do
+ * it, hd_identify() for the drives that can. A request is then done
+ * with one command and one interrupt: the controller follows the PRD
+ * table, a list of physical memory regions built from the buffer
+ * chain. Each region is one buffer (or the page of a paging request),
+ * so none of them crosses a 64kB boundary. Without a controller, or
+ * after a DMA error on the drive, we use PIO as before.
+ */
+#define PRD_ENTRIES	128
+#define PRD_EOT		0x80000000
+
+static unsigned long prd_table[2*PRD_ENTRIES] __attribute__ ((aligned (1024)));
+static unsigned int bmide = 0;
+static int hd_dma[MAX_HD] = {0, };
+
+#define PCI_CONF(dev,fn,reg) \
+	(0x80000000 | ((dev)<<11) | ((fn)<<8) | (reg))
+
 #define port_read(port,buf,nr) \
-__asm__("cld;rep;insw"::"d" (port),"D" (buf),"c" (nr):"cx","di")
+__asm__("cld;rep;insw"::"d" (port),"D" (buf),"c" (nr):"cx","di","memory")
 
 #define port_write(port,buf,nr) \
-__asm__("cld;rep;outsw"::"d" (port),"S" (buf),"c" (nr):"cx","si")
+__asm__("cld;rep;outsw"::"d" (port),"S" (buf),"c" (nr):"cx","si","memory")
+
+#define port_read32(port,buf,nr) \
+__asm__("cld;rep;insl"::"d" (port),"D" (buf),"c" (nr):"cx","di","memory")
+
+#define port_write32(port,buf,nr) \
+__asm__("cld;rep;outsl"::"d" (port),"S" (buf),"c" (nr):"cx","si","memory")
 
 extern void hd_interrupt(void);
 extern void rd_load(void);
@@ -136,6 +181,9 @@ int sys_setup(void * BIOS)
 		hd[i*5].start_sect = 0;
 		hd[i*5].nr_sects = 0;
 	}
+	for (drive=0 ; drive<NR_HD ; drive++)
+		if (hd_identify(drive))
+			reset = 1;	/* reset_hd() turns on multiple mode */
 	for (drive=0 ; drive<NR_HD ; drive++) {
 		if (!(bh = bread(0x300 + drive*5,0))) {
 			printk("Unable to read partition table of drive %d\n\r",
@@ -184,6 +232,49 @@ static int win_result(void)
 	return (1);
 }
 
+/*
+ * hd_identify() asks the drive what it can do: word 47 of the IDENTIFY
+ * data is the largest number of sectors it transfers per interrupt in
+ * multiple mode, bit 0 of word 48 says it can do 32-bit data transfers,
+ * bit 8 of word 49 that it can do DMA.
+ * This is done by polling, with the drive interrupt off (nIEN), as it
+ * is only used at setup. Returns 1 if multiple mode should be used.
+ */
+static int hd_identify(int drive)
+{
+	unsigned short id[256];
+	int i;
+
+	hd_mult[drive] = hd_io32[drive] = hd_dma[drive] = 0;
+	if (!controller_ready())
+		return 0;
+	outb_p(hd_info[drive].ctl | 2,HD_CMD);
+	outb_p(0xA0|(drive<<4),HD_CURRENT);
+	if (controller_ready()) {
+		outb(WIN_IDENTIFY,HD_COMMAND);
+		for (i = 0 ; i < 100000 ; i++)
+			if (!(inb_p(HD_STATUS) & BUSY_STAT))
+				break;
+		if ((inb_p(HD_STATUS) & (BUSY_STAT|DRQ_STAT|ERR_STAT))
+		    == DRQ_STAT) {
+			port_read(HD_DATA,id,256);
+			i = id[47] & 0xff;
+			if (i > MAX_MULT)
+				i = MAX_MULT;
+			if (i > 1)
+				hd_mult[drive] = i;
+			hd_io32[drive] = id[48] & 1;
+			if (bmide && (id[49] & 0x100)) {
+				hd_dma[drive] = 1;
+				outb(inb(bmide+BM_STATUS) | (BM_DRV0_DMA<<drive),
+					bmide+BM_STATUS);
+			}
+		}
+	}
+	outb_p(hd_info[drive].ctl,HD_CMD);
+	return hd_mult[drive] != 0;
+}
+
 static void hd_out(unsigned int drive,unsigned int nsect,unsigned int sect,
 		unsigned int head,unsigned int cyl,unsigned int cmd,
 		void (*intr_addr)(void))
@@ -234,6 +325,11 @@ static void reset_controller(void)
 		printk("HD-controller reset failed: %02x\n\r",i);
 }
 
+/*
+ * After a reset every drive gets a SPECIFY, and a SET MULTIPLE if we
+ * use multiple mode on it: 'i' counts these commands, two per drive.
+ * A drive that doesn't accept SET MULTIPLE just isn't used that way.
+ */
 static void reset_hd(void)
 {
 	static int i;
@@ -244,16 +340,28 @@ repeat:
 		i = -1;
 		reset_controller();
 	} else if (win_result()) {
-		bad_rw_intr();
-		if (reset)
-			goto repeat;
+		if (i & 1) {
+			printk("hd%d: multiple mode not accepted\n\r",i>>1);
+			hd_mult[i>>1] = 0;
+		} else {
+			bad_rw_intr();
+			if (reset)
+				goto repeat;
+		}
 	}
-	i++;
-	if (i < NR_HD) {
-		hd_out(i,hd_info[i].sect,hd_info[i].sect,hd_info[i].head-1,
-			hd_info[i].cyl,WIN_SPECIFY,&reset_hd);
-	} else
-		do_hd_request();
+	while (++i < 2*NR_HD) {
+		if (!(i & 1)) {
+			hd_out(i>>1,hd_info[i>>1].sect,hd_info[i>>1].sect,
+				hd_info[i>>1].head-1,hd_info[i>>1].cyl,
+				WIN_SPECIFY,&reset_hd);
+			return;
+		}
+		if (hd_mult[i>>1]) {
+			hd_out(i>>1,hd_mult[i>>1],0,0,0,WIN_SETMULT,&reset_hd);
+			return;
+		}
+	}
+	do_hd_request();
 }
 
 void unexpected_hd_interrupt(void)
@@ -271,40 +379,160 @@ static void bad_rw_intr(void)
 		reset = 1;
 }
 
+/*
+ * A request may consist of several buffers, but it is done with one
+ * controller command. Each time the sectors of one buffer are done,
+ * end_request() releases it and points CURRENT->buffer at the next.
+ * sector_done() does the book-keeping for one sector, and returns the
+ * number of sectors left.
+ */
+static int sector_done(void)
+{
+	int i;
+
+	CURRENT->errors = 0;
+	CURRENT->buffer += 512;
+	CURRENT->sector++;
+	i = --CURRENT->nr_sectors;
+	if (!--CURRENT->current_nr_sectors)
+		end_request(1);
+	return i;
+}
+
+/*
+ * write_block() gives the drive the next block of sectors: one sector,
+ * or up to mult_count of them in multiple mode. They may be spread over
+ * several buffers, which we may not release until the drive has taken
+ * them, so we just follow the buffer chain here.
+ */
+static void write_block(void)
+{
+	struct buffer_head * bh = CURRENT->bh;
+	char * buf = CURRENT->buffer;
+	int left = CURRENT->current_nr_sectors;
+	int io32 = hd_io32[CURRENT_DEV];
+	int i;
+
+	block_count = mult_count;
+	if (block_count > CURRENT->nr_sectors)
+		block_count = CURRENT->nr_sectors;
+	for (i = 0 ; i < block_count ; i++) {
+		if (io32)
+			port_write32(HD_DATA,buf,128);
+		else
+			port_write(HD_DATA,buf,256);
+		buf += 512;
+		if (!--left && bh && (bh = bh->b_reqnext)) {
+			buf = bh->b_data;
+			left = 2;
+		}
+	}
+}
+
 static void read_intr(void)
 {
+	int i,n;
+
 	if (win_result()) {
 		bad_rw_intr();
 		do_hd_request();
 		return;
 	}
-	port_read(HD_DATA,CURRENT->buffer,256);
-	CURRENT->errors = 0;
-	CURRENT->buffer += 512;
-	CURRENT->sector++;
-	if (--CURRENT->nr_sectors) {
+	n = mult_count;
+	do {
+		if (hd_io32[CURRENT_DEV])
+			port_read32(HD_DATA,CURRENT->buffer,128);
+		else
+			port_read(HD_DATA,CURRENT->buffer,256);
+		i = sector_done();
+	} while (i && --n);
+	if (i) {
 		SET_INTR(&read_intr);
 		return;
 	}
-	end_request(1);
 	do_hd_request();
 }
 
 static void write_intr(void)
 {
+	int i,n;
+
 	if (win_result()) {
 		bad_rw_intr();
 		do_hd_request();
 		return;
 	}
-	if (--CURRENT->nr_sectors) {
-		CURRENT->sector++;
-		CURRENT->buffer += 512;
+	n = block_count;
+	do {
+		i = sector_done();
+	} while (i && --n);
+	if (i) {
 		SET_INTR(&write_intr);
-		port_write(HD_DATA,CURRENT->buffer,256);
+		write_block();
+		return;
+	}
+	do_hd_request();
+}
+
+/*
+ * build_prd() fills the PRD table for the current request. It returns
+ * 0 if the request has too many buffers for it (it can't, as requests
+ * are at most MAX_SECTORS long).
+ */
+static int build_prd(void)
+{
+	struct buffer_head * bh = CURRENT->bh;
+	unsigned long * prd = prd_table;
+
+	*prd++ = (unsigned long) CURRENT->buffer;
+	*prd++ = CURRENT->current_nr_sectors << 9;
+	if (bh)
+		while (bh = bh->b_reqnext) {
+			if (prd >= prd_table + 2*PRD_ENTRIES)
+				return 0;
+			*prd++ = (unsigned long) bh->b_data;
+			*prd++ = BLOCK_SIZE;
+		}
+	prd[-1] |= PRD_EOT;
+	return 1;
+}
+
+static void dma_start(unsigned int drive,unsigned int nsect,
+		unsigned int sect,unsigned int head,unsigned int cyl)
+{
+	int read = (CURRENT->cmd == READ);
+
+	outl((unsigned long) prd_table,bmide+BM_PRD);
+	outb(read ? BM_READ : 0,bmide+BM_COMMAND);
+	outb(inb(bmide+BM_STATUS) | BM_ERROR | BM_INTR,bmide+BM_STATUS);
+	hd_out(drive,nsect,sect,head,cyl,
+		read ? WIN_READDMA : WIN_WRITEDMA,&dma_intr);
+	outb(inb(bmide+BM_COMMAND) | BM_START,bmide+BM_COMMAND);
+}
+
+/*
+ * The whole request is done (or not) when this interrupt comes. If
+ * the controller complains, or the drive doesn't know the command,
+ * the drive is done with PIO from now on.
+ */
+static void dma_intr(void)
+{
+	int stat;
+
+	outb(inb(bmide+BM_COMMAND) & ~BM_START,bmide+BM_COMMAND);
+	stat = inb(bmide+BM_STATUS);
+	outb(stat | BM_ERROR | BM_INTR,bmide+BM_STATUS);
+	if (win_result() || (stat & BM_ERROR)) {
+		if ((stat & BM_ERROR) || (inb(HD_ERROR) & ABRT_ERR)) {
+			printk("hd%d: DMA failed, using PIO\n\r",CURRENT_DEV);
+			hd_dma[CURRENT_DEV] = 0;
+		}
+		bad_rw_intr();
+		do_hd_request();
 		return;
 	}
-	end_request(1);
+	while (sector_done())
+		/* nothing */ ;
 	do_hd_request();
 }
 
@@ -320,6 +548,10 @@ void hd_times_out(void)
 	if (!CURRENT)
 		return;
 	printk("HD timeout");
+	if (do_hd == dma_intr) {
+		outb(0,bmide+BM_COMMAND);
+		hd_dma[CURRENT_DEV] = 0;
+	}
 	if (++CURRENT->errors >= MAX_ERRORS)
 		end_request(0);
 	SET_INTR(NULL);
@@ -337,7 +569,8 @@ void do_hd_request(void)
 	INIT_REQUEST;
 	dev = MINOR(CURRENT->dev);
 	block = CURRENT->sector;
-	if (dev >= 5*NR_HD || block+2 > hd[dev].nr_sects) {
+	nsect = CURRENT->nr_sectors;
+	if (dev >= 5*NR_HD || block+nsect > hd[dev].nr_sects) {
 		end_request(0);
 		goto repeat;
 	}
@@ -348,7 +581,6 @@ void do_hd_request(void)
 	__asm__("divl %4":"=a" (cyl),"=d" (head):"0" (block),"1" (0),
 		"r" (hd_info[dev].head));
 	sec++;
-	nsect = CURRENT->nr_sectors;
 	if (reset) {
 		recalibrate = 1;
 		reset_hd();
@@ -360,23 +592,80 @@ void do_hd_request(void)
 			WIN_RESTORE,&recal_intr);
 		return;
 	}	
+	if (hd_dma[dev] && build_prd()) {
+		dma_start(dev,nsect,sec,head,cyl);
+		return;
+	}
+	mult_count = hd_mult[dev] ? hd_mult[dev] : 1;
 	if (CURRENT->cmd == WRITE) {
-		hd_out(dev,nsect,sec,head,cyl,WIN_WRITE,&write_intr);
+		hd_out(dev,nsect,sec,head,cyl,
+			hd_mult[dev] ? WIN_MULTWRITE : WIN_WRITE,&write_intr);
 		for(i=0 ; i<10000 && !(r=inb_p(HD_STATUS)&DRQ_STAT) ; i++)
 			/* nothing */ ;
 		if (!r) {
 			bad_rw_intr();
 			goto repeat;
 		}
-		port_write(HD_DATA,CURRENT->buffer,256);
+		write_block();
 	} else if (CURRENT->cmd == READ) {
-		hd_out(dev,nsect,sec,head,cyl,WIN_READ,&read_intr);
+		hd_out(dev,nsect,sec,head,cyl,
+			hd_mult[dev] ? WIN_MULTREAD : WIN_READ,&read_intr);
 	} else
 		panic("unknown hd-command");
 }
 
+static unsigned long pci_read(unsigned long addr)
+{
+	outl(addr,0xCF8);
+	return inl(0xCFC);
+}
+
+static void pci_write(unsigned long addr, unsigned long val)
+{
+	outl(addr,0xCF8);
+	outl(val,0xCFC);
+}
+
+/*
+ * Look on PCI bus 0 (configuration mechanism 1) for an ide controller
+ * that can do bus-mastering, with its primary channel at the legacy
+ * ports and irq we use. Enable i/o and bus-mastering on it, and
+ * remember where its bus-master registers are.
+ */
+static void find_bmide(void)
+{
+	unsigned long class,bar;
+	int dev,fn;
+
+	outl(0x80000000,0xCF8);
+	if (inl(0xCF8) != 0x80000000)
+		return;
+	for (dev = 0 ; dev < 32 ; dev++)
+		for (fn = 0 ; fn < 8 ; fn++) {
+			if ((pci_read(PCI_CONF(dev,fn,0)) & 0xffff) == 0xffff) {
+				if (!fn)
+					break;
+				continue;
+			}
+			class = pci_read(PCI_CONF(dev,fn,8)) >> 8;
+			if ((class & 0xffff80) == 0x010180 && !(class & 1)) {
+				bar = pci_read(PCI_CONF(dev,fn,0x20));
+				if (!(bar & 1))
+					continue;
+				pci_write(PCI_CONF(dev,fn,4),
+					(pci_read(PCI_CONF(dev,fn,4)) & 0xffff) | 5);
+				bmide = bar & 0xfffc;
+				printk("hd: bus-master ide at %04x\n\r",bmide);
+				return;
+			}
+			if (!fn && !(pci_read(PCI_CONF(dev,0,0x0c)) & 0x800000))
+				break;
+		}
+}
+
 void hd_init(void)
 {
+	find_bmide();
 	blk_dev[MAJOR_NR].request_fn = DEVICE_REQUEST;
 	set_intr_gate(0x2E,&hd_interrupt);
 	outb_p(inb_p(0x21)&0xfb,0x21);
@@ -11,32 +11,50 @@
 #include <linux/sched.h>
 #include <linux/kernel.h>
 #include <asm/system.h>
+#include <asm/segment.h>
 
 #include "blk.h"
 
 /*
- * The request-struct contains all necessary data
- * to load a nr of sectors into memory
+ * The number of requests each major gets at boot. The request-structs
+ * themselves are carved out of free pages: 'spare_requests' is what is
+ * left of the last page taken.
  */
-struct request request[NR_REQUEST];
+static int nr_requests_init[NR_BLK_DEV] = {
+	0, NR_REQUEST/2, NR_REQUEST/2, NR_REQUEST, 0, 0, 0
+};
 
-/*
- * used to wait on when there are no free requests
- */
-struct task_struct * wait_for_request = NULL;
+static struct request * spare_requests = NULL;
+static int nr_spare_requests = 0;
+
+static void elevator_insert(struct blk_dev_struct * dev, struct request * req);
+static struct request * elevator_next(struct request * req);
+static void deadline_insert(struct blk_dev_struct * dev, struct request * req);
+static struct request * deadline_next(struct request * req);
+static int merge_request(struct blk_dev_struct * dev, int rw,
+	struct buffer_head * bh);
+
+struct blk_sched blk_sched[NR_IOSCHED] = {
+	{ "classic", elevator_insert, elevator_next, merge_request },
+	{ "deadline", deadline_insert, deadline_next, merge_request }
+};
+
+#define CLASSIC (blk_sched+IOSCHED_CLASSIC)
+#define DEADLINE (blk_sched+IOSCHED_DEADLINE)
 
 /* blk_dev_struct is:
  *	do_request-address
  *	next-request
+ *	i/o scheduler used at boot
  */
 struct blk_dev_struct blk_dev[NR_BLK_DEV] = {
-	{ NULL, NULL },		/* no_dev */
-	{ NULL, NULL },		/* dev mem */
-	{ NULL, NULL },		/* dev fd */
-	{ NULL, NULL },		/* dev hd */
-	{ NULL, NULL },		/* dev ttyx */
-	{ NULL, NULL },		/* dev tty */
-	{ NULL, NULL }		/* dev lp */
+	{ NULL, NULL, CLASSIC },	/* no_dev */
+	{ NULL, NULL, CLASSIC },	/* dev mem */
+	{ NULL, NULL, CLASSIC },	/* dev fd */
+	{ NULL, NULL, CLASSIC },	/* dev hd */
+	{ NULL, NULL, CLASSIC },	/* dev ttyx */
+	{ NULL, NULL, CLASSIC },	/* dev tty */
+	{ NULL, NULL, CLASSIC }		/* dev lp */
 };
 
 /*
@@ -52,7 +70,7 @@ static inline void lock_buffer(struct buffer_head * bh)
 {
 	cli();
 	while (bh->b_lock)
-		sleep_on(&bh->b_wait);
+		sleep_on_exclusive(&bh->b_wait);
 	bh->b_lock=1;
 	sti();
 }
@@ -66,27 +84,16 @@ static inline void unlock_buffer(struct buffer_head * bh)
 }
 
 /*
- * add-request adds a request to the linked list.
- * It disables interrupts so that it can muck with the
- * request-lists in peace.
+ * The classic elevator: requests are kept in one-way elevator order,
+ * see IN_ORDER in blk.h.
  *
  * Note that swapping requests always go before other requests,
  * and are done in the order they appear.
  */
-static void add_request(struct blk_dev_struct * dev, struct request * req)
+static void elevator_insert(struct blk_dev_struct * dev, struct request * req)
 {
-	struct request * tmp;
+	struct request * tmp = dev->current_request;
 
-	req->next = NULL;
-	cli();
-	if (req->bh)
-		req->bh->b_dirt = 0;
-	if (!(tmp = dev->current_request)) {
-		dev->current_request = req;
-		sti();
-		(dev->request_fn)();
-		return;
-	}
 	for ( ; tmp->next ; tmp=tmp->next) {
 		if (!req->bh)
 			if (tmp->next->bh)
@@ -100,9 +107,200 @@ static void add_request(struct blk_dev_struct * dev, struct request * req)
 	}
 	req->next=tmp->next;
 	tmp->next=req;
+}
+
+static struct request * elevator_next(struct request * req)
+{
+	return req->next;
+}
+
+/*
+ * The deadline scheduler sorts reads and writes together, just by
+ * sector, and gives every request a time by which it should be done.
+ * Normally the sweep just goes on, but a request that has waited past
+ * its deadline is done next: expired reads (and paging) first, then
+ * expired writes. This bounds the read latency, and keeps requests far
+ * away from the current position from starving.
+ */
+#define READ_EXPIRE	(HZ/2)
+#define WRITE_EXPIRE	(5*HZ)
+
+#define IN_SECTOR_ORDER(s1,s2) \
+((s1)->dev < (s2)->dev || ((s1)->dev == (s2)->dev && \
+(s1)->sector < (s2)->sector))
+
+static void deadline_insert(struct blk_dev_struct * dev, struct request * req)
+{
+	struct request * tmp = dev->current_request;
+
+	req->deadline = jiffies;
+	if (req->bh)
+		req->deadline += (req->cmd == READ) ? READ_EXPIRE : WRITE_EXPIRE;
+	for ( ; tmp->next ; tmp=tmp->next)
+		if ((IN_SECTOR_ORDER(tmp,req) ||
+		    !IN_SECTOR_ORDER(tmp,tmp->next)) &&
+		    IN_SECTOR_ORDER(req,tmp->next))
+			break;
+	req->next=tmp->next;
+	tmp->next=req;
+}
+
+static struct request * deadline_next(struct request * req)
+{
+	struct request * tmp, * prev, * best = NULL, * best_prev = NULL;
+
+	for (prev = req ; tmp = prev->next ; prev = tmp) {
+		if (tmp->deadline > jiffies)
+			continue;
+		if (best && (tmp->cmd > best->cmd || (tmp->cmd == best->cmd &&
+		    tmp->deadline >= best->deadline)))
+			continue;
+		best = tmp;
+		best_prev = prev;
+	}
+	if (!best || best_prev == req)
+		return req->next;
+	best_prev->next = best->next;
+	best->next = req->next;
+	return best;
+}
+
+/*
+ * add-request adds a request to the linked list, using the
+ * scheduler of the device. It disables interrupts so that it
+ * can muck with the request-lists in peace.
+ */
+static void add_request(struct blk_dev_struct * dev, struct request * req)
+{
+	req->next = NULL;
+	cli();
+	if (req->bh)
+		req->bh->b_dirt = 0;
+	if (!dev->current_request) {
+		dev->current_request = req;
+		sti();
+		(dev->request_fn)();
+		return;
+	}
+	(dev->sched->insert)(dev,req);
 	sti();
 }
 
+/*
+ * merge_request() tries to add the buffer to a request that is already
+ * queued: if the block directly follows (or precedes) the blocks of a
+ * request for the same device and direction, it is simply chained to
+ * it. The first request on the list is left alone, as the driver may
+ * already have started on it.
+ */
+static int merge_request(struct blk_dev_struct * dev, int rw,
+	struct buffer_head * bh)
+{
+	struct request * req;
+	unsigned long sector = bh->b_blocknr<<1;
+
+	cli();
+	if (req = dev->current_request)
+		req = req->next;
+	for ( ; req ; req = req->next) {
+		if (!req->bh || req->dev != bh->b_dev || req->cmd != rw ||
+		    req->nr_sectors+2 > MAX_SECTORS)
+			continue;
+		if (req->sector + req->nr_sectors == sector) {
+			bh->b_reqnext = NULL;
+			req->bhtail->b_reqnext = bh;
+			req->bhtail = bh;
+		} else if (req->sector == sector + 2) {
+			bh->b_reqnext = req->bh;
+			req->bh = bh;
+			req->buffer = bh->b_data;
+			req->current_nr_sectors = 2;
+			req->sector = sector;
+		} else
+			continue;
+		req->nr_sectors += 2;
+		bh->b_dirt = 0;
+		sti();
+		return 1;
+	}
+	sti();
+	return 0;
+}
+
+/*
+ * alloc_request() carves a new request-struct out of the spare ones,
+ * taking a new page when they are used up. It may sleep in
+ * get_free_page(), so the spare requests are checked again afterwards.
+ */
+static struct request * alloc_request(void)
+{
+	unsigned long page;
+
+	while (!nr_spare_requests) {
+		if (!(page = get_free_page()))
+			return NULL;
+		if (nr_spare_requests)
+			free_page(page);
+		else {
+			spare_requests = (struct request *) page;
+			nr_spare_requests = PAGE_SIZE/sizeof(struct request);
+		}
+	}
+	nr_spare_requests--;
+	spare_requests->dev = -1;
+	return spare_requests++;
+}
+
+/*
+ * grow_requests() adds up to nr requests to the pool of a major, and
+ * returns the number it could add.
+ */
+static int grow_requests(struct blk_dev_struct * dev, int nr)
+{
+	struct request * req;
+	int added = 0;
+
+	while (added < nr && dev->nr_requests < dev->max_requests) {
+		if (!(req = alloc_request()))
+			break;
+		cli();
+		req->next = dev->free_request;
+		dev->free_request = req;
+		sti();
+		dev->nr_requests++;
+		added++;
+	}
+	return added;
+}
+
+/*
+ * get_request() takes a free request from the pool of the major. We
+ * don't allow the write-requests to fill up the pool completely: we
+ * want some room for reads, they take precedence. The last third of
+ * the requests are only for reads. If 'grow' is set, a pool that has
+ * nothing to give is grown before we give up and return NULL.
+ */
+static struct request * get_request(struct blk_dev_struct * dev, int rw,
+	int grow)
+{
+	struct request * req;
+
+repeat:
+	cli();
+	if ((rw == READ || dev->in_use < (dev->nr_requests*2)/3) &&
+	    (req = dev->free_request)) {
+		dev->free_request = req->next;
+		if (++dev->in_use > dev->max_in_use)
+			dev->max_in_use = dev->in_use;
+		sti();
+		return req;
+	}
+	sti();
+	if (grow && grow_requests(dev,REQUEST_GROW))
+		goto repeat;
+	return NULL;
+}
+
 static void make_request(int major,int rw, struct buffer_head * bh)
 {
 	struct request * req;
@@ -125,27 +323,16 @@ static void make_request(int major,int rw, struct buffer_head * bh)
 		unlock_buffer(bh);
 		return;
 	}
-repeat:
-/* we don't allow the write-requests to fill up the queue completely:
- * we want some room for reads: they take precedence. The last third
- * of the requests are only for reads.
- */
-	if (rw == READ)
-		req = request+NR_REQUEST;
-	else
-		req = request+((NR_REQUEST*2)/3);
-/* find an empty request */
-	while (--req >= request)
-		if (req->dev<0)
-			break;
-/* if none found, sleep on new requests: check for rw_ahead */
-	if (req < request) {
+	if ((blk_dev[major].sched->merge)(major+blk_dev,rw,bh))
+		return;
+/* find an empty request, if none found sleep: check for rw_ahead */
+	while (!(req = get_request(major+blk_dev,rw,!rw_ahead))) {
 		if (rw_ahead) {
 			unlock_buffer(bh);
 			return;
 		}
-		sleep_on(&wait_for_request);
-		goto repeat;
+		blk_dev[major].nr_waits++;
+		sleep_on_exclusive(&blk_dev[major].wait_for_request);
 	}
 /* fill up the request-info, and add it to the queue */
 	req->dev = bh->b_dev;
@@ -153,10 +340,13 @@ repeat:
 	req->errors=0;
 	req->sector = bh->b_blocknr<<1;
 	req->nr_sectors = 2;
+	req->current_nr_sectors = 2;
 	req->buffer = bh->b_data;
 	req->waiting = NULL;
 	req->bh = bh;
+	req->bhtail = bh;
 	req->next = NULL;
+	bh->b_reqnext = NULL;
 	add_request(major+blk_dev,req);
 }
 
@@ -171,14 +361,11 @@ void ll_rw_page(int rw, int dev, int page, char * buffer)
 	}
 	if (rw!=READ && rw!=WRITE)
 		panic("Bad block dev command, must be R/W");
-repeat:
-	req = request+NR_REQUEST;
-	while (--req >= request)
-		if (req->dev<0)
-			break;
-	if (req < request) {
-		sleep_on(&wait_for_request);
-		goto repeat;
+/* paging may use the whole pool, but mustn't grow it: we might be
+ * here because get_free_page() is swapping something out. */
+	while (!(req = get_request(major+blk_dev,READ,0))) {
+		blk_dev[major].nr_waits++;
+		sleep_on_exclusive(&blk_dev[major].wait_for_request);
 	}
 /* fill up the request-info, and add it to the queue */
 	req->dev = dev;
@@ -186,15 +373,62 @@ repeat:
 	req->errors = 0;
 	req->sector = page<<3;
 	req->nr_sectors = 8;
+	req->current_nr_sectors = 8;
 	req->buffer = buffer;
 	req->waiting = current;
 	req->bh = NULL;
+	req->bhtail = NULL;
 	req->next = NULL;
 	current->state = TASK_UNINTERRUPTIBLE;
 	add_request(major+blk_dev,req);
 	schedule();
 }	
 
+/*
+ * ll_rw_chain() does i/o on buffers for consecutive blocks, chained
+ * through b_reqnext, with one request. The swapping code uses it with
+ * buffer heads of its own, that aren't in the cache. Like ll_rw_page()
+ * it doesn't grow the pool. The caller waits for the buffers.
+ */
+void ll_rw_chain(int rw, struct buffer_head * bh)
+{
+	struct buffer_head * tail;
+	struct request * req;
+	unsigned int major = MAJOR(bh->b_dev);
+	int nr = 0;
+
+	if (major >= NR_BLK_DEV || !(blk_dev[major].request_fn)) {
+		printk("Trying to read nonexistent block-device\n\r");
+		return;
+	}
+	if (rw!=READ && rw!=WRITE)
+		panic("Bad block dev command, must be R/W");
+	for (tail = bh ; ; tail = tail->b_reqnext) {
+		lock_buffer(tail);
+		nr += 2;
+		if (!tail->b_reqnext)
+			break;
+	}
+	if (nr > MAX_SECTORS)
+		panic("ll_rw_chain: too many buffers");
+	while (!(req = get_request(major+blk_dev,READ,0))) {
+		blk_dev[major].nr_waits++;
+		sleep_on_exclusive(&blk_dev[major].wait_for_request);
+	}
+	req->dev = bh->b_dev;
+	req->cmd = rw;
+	req->errors = 0;
+	req->sector = bh->b_blocknr<<1;
+	req->nr_sectors = nr;
+	req->current_nr_sectors = 2;
+	req->buffer = bh->b_data;
+	req->waiting = NULL;
+	req->bh = bh;
+	req->bhtail = tail;
+	req->next = NULL;
+	add_request(major+blk_dev,req);
+}
+
 void ll_rw_block(int rw, struct buffer_head * bh)
 {
 	unsigned int major;
@@ -207,12 +441,73 @@ void ll_rw_block(int rw, struct buffer_head * bh)
 	make_request(major,rw,bh);
 }
 
-void blk_dev_init(void)
+/*
+ * blk_ioctl() handles the ioctls common to all block devices: for now
+ * getting and setting the i/o scheduler of the major. Anything else is
+ * -ENOTTY, as it was before block devices had any ioctls.
+ */
+int blk_ioctl(int dev, int cmd, int arg)
 {
+	unsigned int major = MAJOR(dev);
+	struct blk_dev_struct * bd;
+	struct blk_qstat st;
 	int i;
 
-	for (i=0 ; i<NR_REQUEST ; i++) {
-		request[i].dev = -1;
-		request[i].next = NULL;
+	if (major >= NR_BLK_DEV || !(blk_dev[major].request_fn))
+		return -ENOTTY;
+	switch (cmd) {
+		case BLKGETSCHED:
+			return blk_dev[major].sched - blk_sched;
+		case BLKSETSCHED:
+			if (!suser())
+				return -EPERM;
+			if (arg < 0 || arg >= NR_IOSCHED)
+				return -EINVAL;
+			cli();
+			blk_dev[major].sched = blk_sched + arg;
+			sti();
+			return 0;
+		case BLKGETQSTAT:
+			bd = major + blk_dev;
+			verify_area((void *) arg,sizeof(st));
+			st.nr_requests = bd->nr_requests;
+			st.max_requests = bd->max_requests;
+			st.in_use = bd->in_use;
+			st.max_in_use = bd->max_in_use;
+			st.nr_waits = bd->nr_waits;
+			for (i=0 ; i<sizeof(st) ; i++)
+				put_fs_byte(((char *) &st)[i],i+(char *) arg);
+			return 0;
+		case BLKSETQMAX:
+			if (!suser())
+				return -EPERM;
+			if (arg < blk_dev[major].nr_requests ||
+			    arg > MAX_REQUEST_LIMIT)
+				return -EINVAL;
+			blk_dev[major].max_requests = arg;
+			return 0;
+		default:
+			return -ENOTTY;
+	}
+}
+
+/*
+ * Interrupts are still off here, so we fill the pools by hand rather
+ * than using grow_requests(), which would turn them on.
+ */
+void blk_dev_init(void)
+{
+	struct request * req;
+	int i,j;
+
+	for (i=0 ; i<NR_BLK_DEV ; i++) {
+		blk_dev[i].max_requests = MAX_REQUEST;
+		for (j=0 ; j<nr_requests_init[i] ; j++) {
+			if (!(req = alloc_request()))
+				panic("blk_dev_init: no memory for requests");
+			req->next = blk_dev[i].free_request;
+			blk_dev[i].free_request = req;
+			blk_dev[i].nr_requests++;
+		}
 	}
 }
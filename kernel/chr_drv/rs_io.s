@@ -120,10 +120,7 @@ write_char:
 	je write_buffer_empty
 	cmpl $startup,%ebx
 	ja 1f
-	movl proc_list(%ecx),%ebx	# wake up sleeping process
-	testl %ebx,%ebx			# is there any?
-	je 1f
-	movl $0,(%ebx)
+	call wake_writers
 1:	movl tail(%ecx),%ebx
 	movb buf(%ecx,%ebx),%al
 	outb %al,%dx
@@ -135,14 +132,30 @@ write_char:
 	ret
 .align 2
 write_buffer_empty:
-	movl proc_list(%ecx),%ebx	# wake up sleeping process
-	testl %ebx,%ebx			# is there any?
-	je 1f
-	movl $0,(%ebx)
-1:	incl %edx
+	call wake_writers
+	incl %edx
 	inb %dx,%al
 	jmp 1f
 1:	jmp 1f
 1:	andb $0xd,%al		/* disable transmit interrupt */
 	outb %al,%dx
 	ret
+
+/*
+ * Wake up the processes sleeping on the write-queue (%ecx), if any:
+ * proc_list is a wait queue, so this has to go through __wake_up().
+ */
+.align 2
+wake_writers:
+	cmpl $0,proc_list(%ecx)		# anybody sleeping?
+	je 1f
+	pushl %ecx
+	pushl %edx
+	pushl $1
+	leal proc_list(%ecx),%ebx
+	pushl %ebx
+	call ___wake_up
+	addl $8,%esp
+	popl %edx
+	popl %ecx
+1:	ret
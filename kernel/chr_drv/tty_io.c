@@ -15,6 +15,7 @@
 #include <errno.h>
 #include <signal.h>
 #include <unistd.h>
+#include <stddef.h>
 
 #define ALRMMASK (1<<(SIGALRM-1))
 
@@ -407,6 +408,9 @@ void tty_init(void)
 {
 	int i;
 
+	if (offsetof(struct tty_queue,proc_list) != 12 ||
+	    offsetof(struct tty_queue,buf) != 16)
+		panic("struct tty_queue doesn't match rs_io.s and keyboard.S");
 	for (i=0 ; i < QUEUES ; i++)
 		tty_queues[i] = (struct tty_queue) {0,0,0,0,""};
 	rs_queues[0] = (struct tty_queue) {0x3f8,0,0,0,""};
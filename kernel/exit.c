@@ -17,6 +17,7 @@
 
 int sys_pause(void);
 int sys_close(int fd);
+int sys_alarm(long seconds);
 
 void release(struct task_struct * p)
 {
@@ -142,7 +143,7 @@ static inline int send_sig(long sig,struct task_struct * p,int priv)
 		return -EPERM;
 	if ((sig == SIGKILL) || (sig == SIGCONT)) {
 		if (p->state == TASK_STOPPED)
-			p->state = TASK_RUNNING;
+			wake_up_process(p);
 		p->exit_code = 0;
 		p->signal &= ~( (1<<(SIGSTOP-1)) | (1<<(SIGTSTP-1)) |
 				(1<<(SIGTTIN-1)) | (1<<(SIGTTOU-1)) );
@@ -155,6 +156,7 @@ static inline int send_sig(long sig,struct task_struct * p,int priv)
 		p->signal &= ~(1<<(SIGCONT-1));
 	/* Actually deliver the signal */
 	p->signal |= (1<<(sig-1));
+	signal_wake_up(p);
 	return 0;
 }
 
@@ -264,8 +266,10 @@ volatile void do_exit(long code)
 	struct task_struct *p;
 	int i;
 
+	exit_mmap();
 	free_page_tables(get_base(current->ldt[1]),get_limit(0x0f));
 	free_page_tables(get_base(current->ldt[2]),get_limit(0x17));
+	vfork_done();
 	for (i=0 ; i<NR_OPEN ; i++)
 		if (current->filp[i])
 			sys_close(i);
@@ -277,6 +281,7 @@ volatile void do_exit(long code)
 	current->executable = NULL;
 	iput(current->library);
 	current->library = NULL;
+	sys_alarm(0);		/* off the alarm list */
 	current->state = TASK_ZOMBIE;
 	current->exit_code = code;
 	/* 
@@ -297,6 +302,7 @@ volatile void do_exit(long code)
 	}
 	/* Let father know we died */
 	current->p_pptr->signal |= (1<<(SIGCHLD-1));
+	signal_wake_up(current->p_pptr);
 	
 	/*
 	 * This loop does two things:
@@ -309,8 +315,10 @@ volatile void do_exit(long code)
 	if (p = current->p_cptr) {
 		while (1) {
 			p->p_pptr = task[1];
-			if (p->state == TASK_ZOMBIE)
+			if (p->state == TASK_ZOMBIE) {
 				task[1]->signal |= (1<<(SIGCHLD-1));
+				signal_wake_up(task[1]);
+			}
 			/*
 			 * process group orphan check
 			 * Case ii: Our child is in a different pgrp 
@@ -399,6 +407,9 @@ repeat:
 			case TASK_ZOMBIE:
 				current->cutime += p->utime;
 				current->cstime += p->stime;
+				current->cmin_flt += p->min_flt + p->cmin_flt;
+				current->cmaj_flt += p->maj_flt + p->cmaj_flt;
+				current->cnswap += p->nswap + p->cnswap;
 				flag = p->pid;
 				put_fs_long(p->exit_code, stat_addr);
 				release(p);
@@ -84,9 +84,16 @@ int copy_process(int nr,long ebp,long edi,long esi,long gs,long none,
 	p->counter = p->priority;
 	p->signal = 0;
 	p->alarm = 0;
+	p->next_run = p->prev_run = NULL;
+	init_timer(&p->real_timer);
 	p->leader = 0;		/* process leadership doesn't inherit */
 	p->utime = p->stime = 0;
 	p->cutime = p->cstime = 0;
+	p->rss = p->max_rss = 0;
+	p->min_flt = p->maj_flt = p->nswap = 0;
+	p->cmin_flt = p->cmaj_flt = p->cnswap = 0;
+	p->flags &= ~PF_VFORK;
+	p->vfork_wait = NULL;
 	p->start_time = jiffies;
 	p->tss.back_link = 0;
 	p->tss.esp0 = PAGE_SIZE + (long) p;
@@ -109,9 +116,16 @@ int copy_process(int nr,long ebp,long edi,long esi,long gs,long none,
 	p->tss.gs = gs & 0xffff;
 	p->tss.ldt = _LDT(nr);
 	p->tss.trace_bitmap = 0x80000000;
+	p->tss.tr = _TSS(nr);
 	if (last_task_used_math == current)
 		__asm__("clts ; fnsave %0 ; frstor %0"::"m" (p->tss.i387));
+	if (copy_mmap(p)) {
+		task[nr] = NULL;
+		free_page((long) p);
+		return -EAGAIN;
+	}
 	if (copy_mem(nr,p)) {
+		free_mmap(p);
 		task[nr] = NULL;
 		free_page((long) p);
 		return -EAGAIN;
@@ -136,10 +150,36 @@ int copy_process(int nr,long ebp,long edi,long esi,long gs,long none,
 	if (p->p_osptr)
 		p->p_osptr->p_ysptr = p;
 	current->p_cptr = p;
-	p->state = TASK_RUNNING;	/* do this last, just in case */
+	wake_up_process(p);	/* do this last, just in case */
 	return last_pid;
 }
 
+/*
+ * vfork() is a fork() where the parent sleeps until the child has done
+ * an exec or exit (see sys_call.s). Its page tables are shared with
+ * the child meanwhile (see copy_page_tables()), and as the child lets
+ * go of them first, the parent doesn't have to copy any.
+ */
+int vfork_wait(int pid)
+{
+	struct task_struct * p = current->p_cptr;
+
+	if (!p || p->pid != pid)
+		return pid;
+	p->flags |= PF_VFORK;
+	while (p->flags & PF_VFORK)
+		sleep_on(&p->vfork_wait);
+	return pid;
+}
+
+void vfork_done(void)
+{
+	if (current->flags & PF_VFORK) {
+		current->flags &= ~PF_VFORK;
+		wake_up(&current->vfork_wait);
+	}
+}
+
 int find_empty_process(void)
 {
 	int i;
@@ -107,58 +107,160 @@ void math_state_restore()
 }
 
 /*
- *  'schedule()' is the scheduler function. This is GOOD CODE! There
- * probably won't be any reason to change this, as it should work well
- * in all circumstances (ie gives IO-bound processes good response etc).
- * The one thing you might take a look at is the signal-handler code here.
+ * The tasks that can run (all but task 0) are kept on run queues by their
+ * counter, with a bit set in run_bitmap for each queue that isn't empty,
+ * so schedule() finds the task with the largest counter without looking
+ * at the others. Counters above NR_RUNQ-1 share the last queue.
+ *
+ * When all of them have used up their counter, everybody gets a new one.
+ * Tasks that sleep get theirs when they are woken up: counter_epoch
+ * counts the times this has been done, and the counter is worked out
+ * again for the ones a task has missed - or for the last 8 of them, as
+ * earlier ones make no difference to speak of.
+ */
+#define NR_RUNQ 32
+
+static struct task_struct * run_queue[NR_RUNQ];
+static unsigned long run_bitmap = 0;
+static unsigned long counter_epoch = 0;
+
+/* these are called with interrupts off */
+static void add_to_runqueue(struct task_struct * p)
+{
+	struct task_struct * head;
+	unsigned long n = counter_epoch - p->epoch;
+
+	p->epoch = counter_epoch;
+	if (n > 8)
+		n = 8;
+	while (n--)
+		p->counter = (p->counter >> 1) + p->priority;
+	p->runq = (p->counter < NR_RUNQ) ? p->counter : NR_RUNQ-1;
+	if (!(head = run_queue[p->runq])) {
+		p->next_run = p->prev_run = p;
+		run_queue[p->runq] = p;
+		run_bitmap |= 1 << p->runq;
+		return;
+	}
+	p->next_run = head;
+	p->prev_run = head->prev_run;
+	head->prev_run->next_run = p;
+	head->prev_run = p;
+}
+
+static void del_from_runqueue(struct task_struct * p)
+{
+	if (p->next_run == p) {
+		run_queue[p->runq] = NULL;
+		run_bitmap &= ~(1 << p->runq);
+	} else {
+		p->next_run->prev_run = p->prev_run;
+		p->prev_run->next_run = p->next_run;
+		if (run_queue[p->runq] == p)
+			run_queue[p->runq] = p->next_run;
+	}
+	p->next_run = p->prev_run = NULL;
+}
+
+void wake_up_process(struct task_struct * p)
+{
+	unsigned long flags;
+
+	save_flags(flags);
+	cli();
+	p->state = TASK_RUNNING;
+	if (!p->next_run && p != &(init_task.task))
+		add_to_runqueue(p);
+	restore_flags(flags);
+}
+
+/* a signal that isn't blocked wakes up an interruptible sleep */
+void signal_wake_up(struct task_struct * p)
+{
+	if (p->state == TASK_INTERRUPTIBLE &&
+	    (p->signal & ~(_BLOCKABLE & p->blocked)))
+		wake_up_process(p);
+}
+
+static void process_timeout(unsigned long data)
+{
+	struct task_struct * p = (struct task_struct *) data;
+
+	p->timeout = 0;
+	if (p->state == TASK_INTERRUPTIBLE)
+		wake_up_process(p);
+}
+
+/*
+ *  'schedule()' is the scheduler function. It should work well in all
+ * circumstances (ie gives IO-bound processes good response etc): the
+ * task with the largest counter runs, and a sleeping task gets a bigger
+ * one each time the counters are given out again.
  *
  *   NOTE!!  Task 0 is the 'idle' task, which gets called when no other
  * tasks can run. It can not be killed, and it cannot sleep. The 'state'
- * information in task[0] is never used.
+ * information in task[0] is never used, and it's never on a run queue.
  */
 void schedule(void)
 {
-	int i,next,c;
-	struct task_struct ** p;
+	struct task_struct * p, * next;
+	struct timer_list timer;
+	unsigned long flags;
+	int i, timed = 0;
 
-/* check alarm, wake up any interruptible tasks that have got a signal */
-
-	for(p = &LAST_TASK ; p > &FIRST_TASK ; --p)
-		if (*p) {
-			if ((*p)->timeout && (*p)->timeout < jiffies) {
-				(*p)->timeout = 0;
-				if ((*p)->state == TASK_INTERRUPTIBLE)
-					(*p)->state = TASK_RUNNING;
-			}
-			if ((*p)->alarm && (*p)->alarm < jiffies) {
-				(*p)->signal |= (1<<(SIGALRM-1));
-				(*p)->alarm = 0;
+	save_flags(flags);
+	cli();
+	if (current != &(init_task.task)) {
+		if (current->state == TASK_INTERRUPTIBLE) {
+			if (current->signal & ~(_BLOCKABLE & current->blocked))
+				current->state = TASK_RUNNING;
+			else if (current->timeout && current->timeout <= jiffies) {
+				current->timeout = 0;
+				current->state = TASK_RUNNING;
+			} else if ((long) (current->timeout - jiffies) > 0) {
+				/* 0xffffffff and the like are 'forever' */
+				timer.expires = current->timeout;
+				timer.data = (unsigned long) current;
+				timer.function = process_timeout;
+				init_timer(&timer);
+				add_timer(&timer);
+				timed = 1;
 			}
-			if (((*p)->signal & ~(_BLOCKABLE & (*p)->blocked)) &&
-			(*p)->state==TASK_INTERRUPTIBLE)
-				(*p)->state=TASK_RUNNING;
 		}
+		if (current->next_run)
+			del_from_runqueue(current);
+		if (current->state == TASK_RUNNING)
+			add_to_runqueue(current);
+	}
 
 /* this is the scheduler proper: */
 
 	while (1) {
-		c = -1;
-		next = 0;
-		i = NR_TASKS;
-		p = &task[NR_TASKS];
-		while (--i) {
-			if (!*--p)
-				continue;
-			if ((*p)->state == TASK_RUNNING && (*p)->counter > c)
-				c = (*p)->counter, next = i;
+		if (!run_bitmap) {
+			next = &(init_task.task);
+			break;
+		}
+		__asm__("bsrl %1,%0":"=r" (i):"r" (run_bitmap));
+		if (i) {
+			next = run_queue[i];
+			break;
+		}
+		counter_epoch++;
+		p = run_queue[0];
+		p->prev_run->next_run = NULL;
+		run_queue[0] = NULL;
+		run_bitmap = 0;
+		while (next = p) {
+			p = p->next_run;
+			next->counter = next->priority;
+			next->epoch = counter_epoch;
+			add_to_runqueue(next);
 		}
-		if (c) break;
-		for(p = &LAST_TASK ; p > &FIRST_TASK ; --p)
-			if (*p)
-				(*p)->counter = ((*p)->counter >> 1) +
-						(*p)->priority;
 	}
 	switch_to(next);
+	if (timed)
+		del_timer(&timer);
+	restore_flags(flags);
 }
 
 int sys_pause(void)
@@ -168,48 +270,103 @@ int sys_pause(void)
 	return 0;
 }
 
-static inline void __sleep_on(struct task_struct **p, int state)
+/*
+ * Wait queues, see <linux/wait.h>. These can be used from interrupts,
+ * so the lists are only touched with interrupts off.
+ */
+void add_wait_queue(struct wait_queue ** p, struct wait_queue * wait)
+{
+	unsigned long flags;
+
+	save_flags(flags);
+	cli();
+	if (wait->exclusive)
+		while (*p)
+			p = &(*p)->next;
+	wait->next = *p;
+	*p = wait;
+	restore_flags(flags);
+}
+
+void remove_wait_queue(struct wait_queue ** p, struct wait_queue * wait)
 {
-	struct task_struct *tmp;
+	unsigned long flags;
+
+	save_flags(flags);
+	cli();
+	for ( ; *p ; p = &(*p)->next)
+		if (*p == wait) {
+			*p = wait->next;
+			break;
+		}
+	restore_flags(flags);
+}
+
+/*
+ * Wake up the non-exclusive waiters, and 'nr_exclusive' of the exclusive
+ * ones (all of them if it's 0). An exclusive waiter that is awake already
+ * doesn't count: it hasn't got on yet, and the wake-up is for somebody
+ * else.
+ */
+void __wake_up(struct wait_queue ** p, int nr_exclusive)
+{
+	struct wait_queue * wait;
+	struct task_struct * tsk;
+	unsigned long flags;
+
+	if (!p)
+		return;
+	save_flags(flags);
+	cli();
+	for (wait = *p ; wait ; wait = wait->next) {
+		tsk = wait->task;
+		if (tsk->state == TASK_RUNNING)
+			continue;
+		if (tsk->state == TASK_STOPPED)
+			printk("wake_up: TASK_STOPPED");
+		if (tsk->state == TASK_ZOMBIE)
+			printk("wake_up: TASK_ZOMBIE");
+		wake_up_process(tsk);
+		if (wait->exclusive && nr_exclusive && !--nr_exclusive)
+			break;
+	}
+	restore_flags(flags);
+}
+
+static inline void __sleep_on(struct wait_queue **p, int state, int exclusive)
+{
+	struct wait_queue wait;
+	unsigned long flags;
 
 	if (!p)
 		return;
 	if (current == &(init_task.task))
 		panic("task[0] trying to sleep");
-	tmp = *p;
-	*p = current;
+	wait.task = current;
+	wait.exclusive = exclusive;
+	save_flags(flags);
+	cli();
+	add_wait_queue(p,&wait);
 	current->state = state;
-repeat:	schedule();
-	if (*p && *p != current) {
-		(**p).state = 0;
-		current->state = TASK_UNINTERRUPTIBLE;
-		goto repeat;
-	}
-	if (!*p)
-		printk("Warning: *P = NULL\n\r");
-	if (*p = tmp)
-		tmp->state=0;
+	schedule();
+	remove_wait_queue(p,&wait);
+	restore_flags(flags);
 }
 
-void interruptible_sleep_on(struct task_struct **p)
+void interruptible_sleep_on(struct wait_queue **p)
 {
-	__sleep_on(p,TASK_INTERRUPTIBLE);
+	__sleep_on(p,TASK_INTERRUPTIBLE,0);
 }
 
-void sleep_on(struct task_struct **p)
+void sleep_on(struct wait_queue **p)
 {
-	__sleep_on(p,TASK_UNINTERRUPTIBLE);
+	__sleep_on(p,TASK_UNINTERRUPTIBLE,0);
 }
 
-void wake_up(struct task_struct **p)
+/* for locks and the like: see <linux/wait.h> */
+void sleep_on_exclusive(struct wait_queue **p)
 {
-	if (p && *p) {
-		if ((**p).state == TASK_STOPPED)
-			printk("wake_up: TASK_STOPPED");
-		if ((**p).state == TASK_ZOMBIE)
-			printk("wake_up: TASK_ZOMBIE");
-		(**p).state=0;
-	}
+	__sleep_on(p,TASK_UNINTERRUPTIBLE,1);
 }
 
 /*
@@ -217,7 +374,7 @@ void wake_up(struct task_struct **p)
  * proper. They are here because the floppy needs a timer, and this
  * was the easiest way of doing it.
  */
-static struct task_struct * wait_motor[4] = {NULL,NULL,NULL,NULL};
+static struct wait_queue * wait_motor[4] = {NULL,NULL,NULL,NULL};
 static int  mon_timer[4]={0,0,0,0};
 static int moff_timer[4]={0,0,0,0};
 unsigned char current_DOR = 0x0C;
@@ -280,45 +437,143 @@ void do_floppy_timer(void)
 	}
 }
 
-#define TIME_REQUESTS 64
+/*
+ * The timers are kept on a timer wheel: tv1 has a list for each of the
+ * next 256 ticks, and each of tv2-tv5 has 64 lists that each cover a
+ * whole turn of the one before it. When tv1 has gone round once, the
+ * next list of tv2 is spread out over tv1, and so on up. Adding and
+ * removing a timer is O(1), and so is the work per tick, counted over
+ * a turn.
+ *
+ * A timer's 'prev' points at the list head for the first one on a list:
+ * this works as 'next' is the first field of a timer_list.
+ */
+#define TVN_BITS 6
+#define TVR_BITS 8
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVR_MASK (TVR_SIZE - 1)
+
+struct timer_vec {
+	int index;
+	struct timer_list * vec[TVN_SIZE];
+};
+
+struct timer_vec_root {
+	int index;
+	struct timer_list * vec[TVR_SIZE];
+};
+
+static struct timer_vec tv5 = { 0 };
+static struct timer_vec tv4 = { 0 };
+static struct timer_vec tv3 = { 0 };
+static struct timer_vec tv2 = { 0 };
+static struct timer_vec_root tv1 = { 0 };
 
-static struct timer_list {
-	long jiffies;
-	void (*fn)();
-	struct timer_list * next;
-} timer_list[TIME_REQUESTS], * next_timer = NULL;
+static struct timer_vec * const tvecs[] = {
+	(struct timer_vec *) &tv1, &tv2, &tv3, &tv4, &tv5
+};
 
-void add_timer(long jiffies, void (*fn)(void))
+#define NOOF_TVECS (sizeof(tvecs) / sizeof(tvecs[0]))
+
+static unsigned long timer_jiffies = 0;
+
+static void internal_add_timer(struct timer_list * timer)
 {
-	struct timer_list * p;
+	unsigned long expires = timer->expires;
+	unsigned long idx = expires - timer_jiffies;
+	struct timer_list ** vec;
+
+	if (idx < TVR_SIZE)
+		vec = tv1.vec + (expires & TVR_MASK);
+	else if (idx < 1 << (TVR_BITS + TVN_BITS))
+		vec = tv2.vec + ((expires >> TVR_BITS) & TVN_MASK);
+	else if (idx < 1 << (TVR_BITS + 2*TVN_BITS))
+		vec = tv3.vec + ((expires >> (TVR_BITS + TVN_BITS)) & TVN_MASK);
+	else if (idx < 1 << (TVR_BITS + 3*TVN_BITS))
+		vec = tv4.vec +
+			((expires >> (TVR_BITS + 2*TVN_BITS)) & TVN_MASK);
+	else if ((long) idx < 0)	/* run out already: next tick */
+		vec = tv1.vec + tv1.index;
+	else
+		vec = tv5.vec +
+			((expires >> (TVR_BITS + 3*TVN_BITS)) & TVN_MASK);
+	timer->next = *vec;
+	if (timer->next)
+		timer->next->prev = timer;
+	timer->prev = (struct timer_list *) vec;
+	*vec = timer;
+}
 
-	if (!fn)
-		return;
+static int detach_timer(struct timer_list * timer)
+{
+	if (!timer->prev)
+		return 0;
+	if (timer->next)
+		timer->next->prev = timer->prev;
+	timer->prev->next = timer->next;
+	timer->next = timer->prev = NULL;
+	return 1;
+}
+
+void add_timer(struct timer_list * timer)
+{
+	unsigned long flags;
+
+	save_flags(flags);
 	cli();
-	if (jiffies <= 0)
-		(fn)();
-	else {
-		for (p = timer_list ; p < timer_list + TIME_REQUESTS ; p++)
-			if (!p->fn)
-				break;
-		if (p >= timer_list + TIME_REQUESTS)
-			panic("No more time requests free");
-		p->fn = fn;
-		p->jiffies = jiffies;
-		p->next = next_timer;
-		next_timer = p;
-		while (p->next && p->next->jiffies < p->jiffies) {
-			p->jiffies -= p->next->jiffies;
-			fn = p->fn;
-			p->fn = p->next->fn;
-			p->next->fn = fn;
-			jiffies = p->jiffies;
-			p->jiffies = p->next->jiffies;
-			p->next->jiffies = jiffies;
-			p = p->next;
+	detach_timer(timer);
+	internal_add_timer(timer);
+	restore_flags(flags);
+}
+
+int del_timer(struct timer_list * timer)
+{
+	unsigned long flags;
+	int ret;
+
+	save_flags(flags);
+	cli();
+	ret = detach_timer(timer);
+	restore_flags(flags);
+	return ret;
+}
+
+static void cascade_timers(struct timer_vec * tv)
+{
+	struct timer_list * timer, * next;
+
+	timer = tv->vec[tv->index];
+	tv->vec[tv->index] = NULL;
+	while (timer) {
+		next = timer->next;
+		internal_add_timer(timer);
+		timer = next;
+	}
+	tv->index = (tv->index + 1) & TVN_MASK;
+}
+
+/* called from do_timer(), with interrupts off */
+static void run_timer_list(void)
+{
+	struct timer_list * timer;
+	int n;
+
+	while ((long) (jiffies - timer_jiffies) >= 0) {
+		if (!tv1.index) {
+			n = 1;
+			do {
+				cascade_timers(tvecs[n]);
+			} while (tvecs[n]->index == 1 && ++n < NOOF_TVECS);
+		}
+		while (timer = tv1.vec[tv1.index]) {
+			detach_timer(timer);
+			timer->function(timer->data);
 		}
+		timer_jiffies++;
+		tv1.index = (tv1.index + 1) & TVR_MASK;
 	}
-	sti();
 }
 
 void do_timer(long cpl)
@@ -348,17 +603,8 @@ void do_timer(long cpl)
 	else
 		current->stime++;
 
-	if (next_timer) {
-		next_timer->jiffies--;
-		while (next_timer && next_timer->jiffies <= 0) {
-			void (*fn)(void);
-			
-			fn = next_timer->fn;
-			next_timer->fn = NULL;
-			next_timer = next_timer->next;
-			(fn)();
-		}
-	}
+	run_timer_list();
+
 	if (current_DOR & 0xf0)
 		do_floppy_timer();
 	if ((--current->counter)>0) return;
@@ -367,13 +613,29 @@ void do_timer(long cpl)
 	schedule();
 }
 
+static void it_real_fn(unsigned long data)
+{
+	struct task_struct * p = (struct task_struct *) data;
+
+	p->alarm = 0;
+	p->signal |= (1<<(SIGALRM-1));
+	signal_wake_up(p);
+}
+
 int sys_alarm(long seconds)
 {
 	int old = current->alarm;
 
 	if (old)
 		old = (old - jiffies) / HZ;
+	del_timer(&current->real_timer);
 	current->alarm = (seconds>0)?(jiffies+HZ*seconds):0;
+	if (current->alarm) {
+		current->real_timer.expires = current->alarm;
+		current->real_timer.data = (unsigned long) current;
+		current->real_timer.function = it_real_fn;
+		add_timer(&current->real_timer);
+	}
 	return (old);
 }
 
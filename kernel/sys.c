@@ -227,8 +227,11 @@ int sys_times(struct tms * tbuf)
 
 int sys_brk(unsigned long end_data_seg)
 {
+	struct vm_area_struct * vma = find_vma(current,current->brk);
+
 	if (end_data_seg >= current->end_code &&
-	    end_data_seg < current->start_stack - 16384)
+	    end_data_seg < current->start_stack - 16384 &&
+	    (!vma || end_data_seg <= vma->vm_start))
 		current->brk = end_data_seg;
 	return current->brk;
 }
@@ -423,11 +426,18 @@ int sys_getrusage(int who, struct rusage *ru)
 		r.ru_utime.tv_usec = CT_TO_USECS(current->utime);
 		r.ru_stime.tv_sec = CT_TO_SECS(current->stime);
 		r.ru_stime.tv_usec = CT_TO_USECS(current->stime);
+		r.ru_maxrss = current->max_rss;
+		r.ru_minflt = current->min_flt;
+		r.ru_majflt = current->maj_flt;
+		r.ru_nswap = current->nswap;
 	} else {
 		r.ru_utime.tv_sec = CT_TO_SECS(current->cutime);
 		r.ru_utime.tv_usec = CT_TO_USECS(current->cutime);
 		r.ru_stime.tv_sec = CT_TO_SECS(current->cstime);
 		r.ru_stime.tv_usec = CT_TO_USECS(current->cstime);
+		r.ru_minflt = current->cmin_flt;
+		r.ru_majflt = current->cmaj_flt;
+		r.ru_nswap = current->cnswap;
 	}
 	lp = (unsigned long *) &r;
 	lpend = (unsigned long *) (&r+1);
@@ -68,7 +68,7 @@ ENOSYS = 38
  * Ok, I get parallel printer interrupts while using the floppy for some
  * strange reason. Urgel. Now I just ignore them.
  */
-.globl _system_call,_sys_fork,_timer_interrupt,_sys_execve
+.globl _system_call,_sys_fork,_sys_vfork,_timer_interrupt,_sys_execve
 .globl _hd_interrupt,_floppy_interrupt,_parallel_interrupt
 .globl _device_not_available, _coprocessor_error
 
@@ -232,6 +232,25 @@ _sys_fork:
 	addl $20,%esp
 1:	ret
 
+.align 2
+_sys_vfork:
+	call _find_empty_process
+	testl %eax,%eax
+	js 1f
+	push %gs
+	pushl %esi
+	pushl %edi
+	pushl %ebp
+	pushl %eax
+	call _copy_process
+	addl $20,%esp
+	testl %eax,%eax
+	js 1f
+	pushl %eax
+	call _vfork_wait
+	addl $4,%esp
+1:	ret
+
 _hd_interrupt:
 	pushl %eax
 	pushl %ecx
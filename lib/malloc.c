@@ -21,8 +21,8 @@
  * stored on pages requested from get_free_page().  However, unlike buckets,
  * pages devoted to bucket descriptor pages are never released back to the
  * system.  Fortunately, a system should probably only need 1 or 2 bucket
- * descriptor pages, since a page can hold 256 bucket descriptors (which
- * corresponds to 1 megabyte worth of bucket pages.)  If the kernel is using 
+ * descriptor pages, since a page can hold 204 bucket descriptors (which
+ * corresponds to 800k worth of bucket pages.)  If the kernel is using 
  * that much allocated memory, it's probably doing something wrong.  :-)
  *
  * Note: malloc() and free() both call get_free_page() and free_page()
@@ -49,17 +49,18 @@
 #include <linux/mm.h>
 #include <asm/system.h>
 
-struct bucket_desc {	/* 16 bytes */
+struct bucket_desc {	/* 20 bytes */
 	void			*page;
-	struct bucket_desc	*next;
+	struct bucket_desc	*next, *prev;
 	void			*freeptr;
 	unsigned short		refcnt;
 	unsigned short		bucket_size;
 };
 
-struct _bucket_dir {	/* 8 bytes */
+struct _bucket_dir {	/* 20 bytes */
 	int			size;
 	struct bucket_desc	*chain;
+	unsigned long		allocs, frees, pages;	/* statistics */
 };
 
 /*
@@ -75,22 +76,31 @@ struct _bucket_dir {	/* 8 bytes */
  * Note that this list *must* be kept in order.
  */
 struct _bucket_dir bucket_dir[] = {
-	{ 16,	(struct bucket_desc *) 0},
-	{ 32,	(struct bucket_desc *) 0},
-	{ 64,	(struct bucket_desc *) 0},
-	{ 128,	(struct bucket_desc *) 0},
-	{ 256,	(struct bucket_desc *) 0},
-	{ 512,	(struct bucket_desc *) 0},
-	{ 1024,	(struct bucket_desc *) 0},
-	{ 2048, (struct bucket_desc *) 0},
-	{ 4096, (struct bucket_desc *) 0},
-	{ 0,    (struct bucket_desc *) 0}};   /* End of list marker */
+	{ 16,	(struct bucket_desc *) 0, 0, 0, 0},
+	{ 32,	(struct bucket_desc *) 0, 0, 0, 0},
+	{ 64,	(struct bucket_desc *) 0, 0, 0, 0},
+	{ 128,	(struct bucket_desc *) 0, 0, 0, 0},
+	{ 256,	(struct bucket_desc *) 0, 0, 0, 0},
+	{ 512,	(struct bucket_desc *) 0, 0, 0, 0},
+	{ 1024,	(struct bucket_desc *) 0, 0, 0, 0},
+	{ 2048, (struct bucket_desc *) 0, 0, 0, 0},
+	{ 4096, (struct bucket_desc *) 0, 0, 0, 0},
+	{ 0,    (struct bucket_desc *) 0, 0, 0, 0}};   /* End of list marker */
 
 /*
  * This contains a linked list of free bucket descriptor blocks
  */
 struct bucket_desc *free_bucket_desc = (struct bucket_desc *) 0;
 
+/*
+ * The bucket descriptor of each page that malloc() has given out
+ * objects from, indexed like mem_map[].  This is what lets free_s() find
+ * the descriptor without searching the chains.
+ */
+static struct bucket_desc *bucket_map[PAGING_PAGES];
+
+#define bucket_of(page) bucket_map[MAP_NR((unsigned long) (page))]
+
 /*
  * This routine initializes a bucket description page.
  */
@@ -162,67 +172,59 @@ void *malloc(unsigned int len)
 			cp += bdir->size;
 		}
 		*((char **) cp) = 0;
+		bucket_of(bdesc->page) = bdesc;
+		bdesc->prev = 0;
 		bdesc->next = bdir->chain; /* OK, link it in! */
+		if (bdesc->next)
+			bdesc->next->prev = bdesc;
 		bdir->chain = bdesc;
+		bdir->pages++;
 	}
 	retval = (void *) bdesc->freeptr;
 	bdesc->freeptr = *((void **) retval);
 	bdesc->refcnt++;
+	bdir->allocs++;
 	sti();	/* OK, we're safe again */
 	return(retval);
 }
 
 /*
- * Here is the free routine.  If you know the size of the object that you
- * are freeing, then free_s() will use that information to speed up the
- * search for the bucket descriptor.
+ * Here is the free routine.  The bucket descriptor of the object's page
+ * is found in bucket_map[], so the size of the object isn't needed any
+ * more: if it is given, it's only checked.
  * 
  * We will #define a macro so that "free(x)" is becomes "free_s(x, 0)"
  */
 void free_s(void *obj, int size)
 {
-	void		*page;
+	unsigned long		page;
 	struct _bucket_dir	*bdir;
-	struct bucket_desc	*bdesc, *prev;
+	struct bucket_desc	*bdesc;
 
 	/* Calculate what page this object lives in */
-	page = (void *)  ((unsigned long) obj & 0xfffff000);
-	/* Now search the buckets looking for that page */
-	for (bdir = bucket_dir; bdir->size; bdir++) {
-		prev = 0;
-		/* If size is zero then this conditional is always false */
-		if (bdir->size < size)
-			continue;
-		for (bdesc = bdir->chain; bdesc; bdesc = bdesc->next) {
-			if (bdesc->page == page) 
-				goto found;
-			prev = bdesc;
-		}
-	}
-	panic("Bad address passed to kernel free_s()");
-found:
+	page = (unsigned long) obj & 0xfffff000;
+	if (page < LOW_MEM || page >= HIGH_MEMORY)
+		panic("Bad address passed to kernel free_s()");
 	cli(); /* To avoid race conditions */
+	bdesc = bucket_of(page);
+	if (!bdesc || (unsigned long) bdesc->page != page ||
+	    bdesc->bucket_size < size)
+		panic("Bad address passed to kernel free_s()");
+	for (bdir = bucket_dir; bdir->size != bdesc->bucket_size; bdir++)
+		/* nothing */ ;
 	*((void **)obj) = bdesc->freeptr;
 	bdesc->freeptr = obj;
-	bdesc->refcnt--;
-	if (bdesc->refcnt == 0) {
-		/*
-		 * We need to make sure that prev is still accurate.  It
-		 * may not be, if someone rudely interrupted us....
-		 */
-		if ((prev && (prev->next != bdesc)) ||
-		    (!prev && (bdir->chain != bdesc)))
-			for (prev = bdir->chain; prev; prev = prev->next)
-				if (prev->next == bdesc)
-					break;
-		if (prev)
-			prev->next = bdesc->next;
-		else {
-			if (bdir->chain != bdesc)
-				panic("malloc bucket chains corrupted");
+	bdir->frees++;
+	if (--bdesc->refcnt == 0) {
+		if (bdesc->next)
+			bdesc->next->prev = bdesc->prev;
+		if (bdesc->prev)
+			bdesc->prev->next = bdesc->next;
+		else
 			bdir->chain = bdesc->next;
-		}
-		free_page((unsigned long) bdesc->page);
+		bdir->pages--;
+		bucket_of(page) = 0;
+		free_page(page);
 		bdesc->next = free_bucket_desc;
 		free_bucket_desc = bdesc;
 	}
@@ -230,3 +232,217 @@ found:
 	return;
 }
 
+void malloc_show(void)
+{
+	struct _bucket_dir *bdir;
+
+	for (bdir = bucket_dir; bdir->size; bdir++)
+		printk("malloc-%-9d %4d bytes: %6d in use, %4d pages"
+			" (%d allocs, %d frees)\n\r",
+			bdir->size, bdir->size,
+			bdir->allocs - bdir->frees, bdir->pages,
+			bdir->allocs, bdir->frees);
+}
+
+
+/*
+ * Object caches, for kernel objects that are allocated and freed a lot.
+ * Each cache has pages (slabs) of objects of one size, with a header at
+ * the start of each page that holds its free list: the header is found
+ * from an object's address, so freeing is O(1) just like allocating,
+ * and there's no rounding up to a power of two. The slabs with free
+ * objects are kept on a list in the cache. One slab that becomes empty
+ * is kept, so that a cache that goes up and down by an object (as
+ * select() does on every call) doesn't get and clear a page each time;
+ * the others are given back, and so is that one when memory runs short
+ * (kmem_cache_shrink()).
+ *
+ * A constructor, if any, is called for each object when its slab is
+ * set up, not on every allocation: objects are to be freed in their
+ * constructed state, except for the first word, which is the free list.
+ */
+struct kmem_slab {
+	struct kmem_cache	*cache;
+	struct kmem_slab	*next, *prev;	/* slabs with free objects */
+	void			*freeptr;
+	unsigned short		inuse;
+};
+
+struct kmem_cache {
+	const char		*name;
+	unsigned short		size;
+	unsigned short		per_slab;
+	void			(*ctor)(void *);
+	struct kmem_slab	*slabs;		/* with free objects */
+	struct kmem_slab	*empty;		/* kept for the next alloc */
+	unsigned long		allocs, frees, pages;
+	struct kmem_cache	*next;
+};
+
+#define SLAB_HEADER ((sizeof(struct kmem_slab)+7) & ~7)
+
+static struct kmem_cache *cache_chain = (struct kmem_cache *) 0;
+
+struct kmem_cache *kmem_cache_create(const char *name, int size,
+	void (*ctor)(void *))
+{
+	struct kmem_cache *cachep;
+
+	size = (size + 3) & ~3;
+	if (size < sizeof(void *) || size > PAGE_SIZE - SLAB_HEADER)
+		panic("kmem_cache_create: bad object size");
+	cachep = (struct kmem_cache *) malloc(sizeof(struct kmem_cache));
+	if (!cachep)
+		return (struct kmem_cache *) 0;
+	cachep->name = name;
+	cachep->size = size;
+	cachep->per_slab = (PAGE_SIZE - SLAB_HEADER) / size;
+	cachep->ctor = ctor;
+	cachep->slabs = cachep->empty = (struct kmem_slab *) 0;
+	cachep->allocs = cachep->frees = cachep->pages = 0;
+	cachep->next = cache_chain;
+	cache_chain = cachep;
+	return cachep;
+}
+
+static inline void slab_unlink(struct kmem_slab *slab)
+{
+	if (slab->next)
+		slab->next->prev = slab->prev;
+	if (slab->prev)
+		slab->prev->next = slab->next;
+	else
+		slab->cache->slabs = slab->next;
+}
+
+static inline void slab_link(struct kmem_slab *slab)
+{
+	slab->prev = (struct kmem_slab *) 0;
+	slab->next = slab->cache->slabs;
+	if (slab->next)
+		slab->next->prev = slab;
+	slab->cache->slabs = slab;
+}
+
+/*
+ * A new slab. get_free_page() may swap and sleep, so kmem_cache_alloc()
+ * is not for interrupt level - and as with malloc(), interrupts aren't
+ * held off over it.
+ */
+static struct kmem_slab *kmem_slab_grow(struct kmem_cache *cachep)
+{
+	struct kmem_slab *slab;
+	char *cp;
+	int i;
+
+	if (!(slab = (struct kmem_slab *) get_free_page()))
+		return (struct kmem_slab *) 0;
+	slab->cache = cachep;
+	slab->inuse = 0;
+	slab->freeptr = cp = SLAB_HEADER + (char *) slab;
+	for (i = cachep->per_slab; i > 0; i--) {
+		if (cachep->ctor)
+			cachep->ctor(cp);
+		*((char **) cp) = (i > 1) ? cp + cachep->size : (char *) 0;
+		cp += cachep->size;
+	}
+	return slab;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cachep)
+{
+	struct kmem_slab *slab, *new = (struct kmem_slab *) 0;
+	void *retval;
+	unsigned long flags;
+
+	save_flags(flags);
+	cli();
+	while (!(slab = cachep->slabs)) {
+		restore_flags(flags);
+		if (new)
+			free_page((unsigned long) new);
+		if (!(new = kmem_slab_grow(cachep)))
+			return (void *) 0;
+		cli();
+		if (!cachep->slabs) {
+			slab_link(new);
+			cachep->pages++;
+			new = (struct kmem_slab *) 0;
+		}
+	}
+	if (slab == cachep->empty)
+		cachep->empty = (struct kmem_slab *) 0;
+	retval = slab->freeptr;
+	slab->freeptr = *((void **) retval);
+	if (++slab->inuse == cachep->per_slab)
+		slab_unlink(slab);
+	cachep->allocs++;
+	restore_flags(flags);
+	if (new)
+		free_page((unsigned long) new);
+	return retval;
+}
+
+void kmem_cache_free(struct kmem_cache *cachep, void *obj)
+{
+	struct kmem_slab *slab;
+	unsigned long flags;
+
+	slab = (struct kmem_slab *) ((unsigned long) obj & 0xfffff000);
+	if (slab->cache != cachep)
+		panic("Bad address passed to kmem_cache_free()");
+	save_flags(flags);
+	cli();
+	if (slab->inuse-- == cachep->per_slab)
+		slab_link(slab);
+	*((void **) obj) = slab->freeptr;
+	slab->freeptr = obj;
+	cachep->frees++;
+	if (!slab->inuse) {
+		if (!cachep->empty) {
+			cachep->empty = slab;
+			restore_flags(flags);
+			return;
+		}
+		slab_unlink(slab);
+		cachep->pages--;
+		restore_flags(flags);
+		free_page((unsigned long) slab);
+		return;
+	}
+	restore_flags(flags);
+}
+
+/* give back a kept empty slab. Returns 1 if there was one */
+int kmem_cache_shrink(void)
+{
+	struct kmem_cache *cachep;
+	struct kmem_slab *slab;
+	unsigned long flags;
+
+	save_flags(flags);
+	cli();
+	for (cachep = cache_chain; cachep; cachep = cachep->next)
+		if (slab = cachep->empty) {
+			cachep->empty = (struct kmem_slab *) 0;
+			slab_unlink(slab);
+			cachep->pages--;
+			restore_flags(flags);
+			free_page((unsigned long) slab);
+			return 1;
+		}
+	restore_flags(flags);
+	return 0;
+}
+
+void kmem_cache_show(void)
+{
+	struct kmem_cache *cachep;
+
+	for (cachep = cache_chain; cachep; cachep = cachep->next)
+		printk("%-16s %4d bytes: %6d in use, %4d pages"
+			" (%d allocs, %d frees)\n\r",
+			cachep->name, cachep->size,
+			cachep->allocs - cachep->frees, cachep->pages,
+			cachep->allocs, cachep->frees);
+}
@@ -0,0 +1,210 @@
+/*
+ *  linux/mm/filemap.c
+ *
+ *  (C) 1991  Linus Torvalds
+ */
+
+/*
+ * The page cache keeps whole pages of file data as do_no_page() reads
+ * them in for executables, libraries and mmap(), so that they can be
+ * mapped again without going through the buffer cache - also after the
+ * last process using them has gone. A page is found by its in-core
+ * inode and the number of its first block in the file. The cache holds
+ * a reference to it in mem_map[]. A private mapping maps it read-only,
+ * so writing to it gets a private copy (see un_wp_page()); a shared
+ * writable mapping maps it writable, so every process that maps the
+ * block has the very same page, and its changes go back to the file
+ * from it (sync_vma()).
+ *
+ * A cached page is what the file holds: read() takes the blocks it
+ * has from it, and write() changes it along with the buffer. Pages
+ * that aren't mapped anywhere (so their changes have gone back to the
+ * file) are given back when memory runs short (shrink_page_cache()),
+ * or when a new page needs the entry. The pages of an inode are
+ * forgotten when the file is truncated, and when the inode leaves the
+ * inode cache.
+ */
+#include <string.h>
+
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/mm.h>
+
+#define NR_PAGE_CACHE 512
+#define NR_PAGE_HASH 127
+
+static struct page_cache_entry {
+	struct m_inode * inode;		/* NULL if unused */
+	unsigned long block;
+	unsigned long page;
+	int referenced;
+	struct page_cache_entry * next_hash;
+} page_cache[NR_PAGE_CACHE];
+
+static struct page_cache_entry * page_hash[NR_PAGE_HASH];
+
+#define _hashfn(inode,block) \
+	(((((unsigned long) (inode)) >> 4) ^ (block)) % NR_PAGE_HASH)
+#define hash(inode,block) page_hash[_hashfn(inode,block)]
+
+static struct page_cache_entry * find_entry(struct m_inode * inode,
+	unsigned long block)
+{
+	struct page_cache_entry * e;
+
+	for (e = hash(inode,block) ; e ; e = e->next_hash)
+		if (e->inode == inode && e->block == block)
+			return e;
+	return NULL;
+}
+
+static void drop_entry(struct page_cache_entry * e)
+{
+	struct page_cache_entry ** p;
+
+	for (p = &hash(e->inode,e->block) ; *p ; p = &(*p)->next_hash)
+		if (*p == e) {
+			*p = e->next_hash;
+			break;
+		}
+	e->inode->i_pages--;
+	e->inode = NULL;
+	free_page(e->page);
+}
+
+/*
+ * Entries are reclaimed with the clock algorithm, like the pages in
+ * swap_out(): a page that has been found since we last looked gets
+ * another round. Pages that are mapped somewhere are left alone.
+ * With 'empty' set, an unused entry will do as well.
+ */
+static struct page_cache_entry * reclaim_entry(int empty)
+{
+	static int hand = 0;
+	struct page_cache_entry * e;
+	int i;
+
+	for (i = 2*NR_PAGE_CACHE ; i-- > 0 ; ) {
+		e = page_cache + hand;
+		if (++hand >= NR_PAGE_CACHE)
+			hand = 0;
+		if (!e->inode) {
+			if (empty)
+				return e;
+			continue;
+		}
+		if (mem_map[MAP_NR(e->page)] > 1)
+			continue;
+		if (e->referenced) {
+			e->referenced = 0;
+			continue;
+		}
+		drop_entry(e);
+		return e;
+	}
+	return NULL;
+}
+
+/*
+ * find_page_cache() returns the cached page for 'block' of 'inode', with
+ * a new reference to it, 0 if there's none.
+ */
+unsigned long find_page_cache(struct m_inode * inode, unsigned long block)
+{
+	struct page_cache_entry * e;
+
+	if (!inode->i_pages || !(e = find_entry(inode,block)))
+		return 0;
+	e->referenced = 1;
+	mem_map[MAP_NR(e->page)]++;
+	return e->page;
+}
+
+/*
+ * find_block_page() is find_page_cache() for the page that holds 1k
+ * block 'block' of the file, wherever that page starts: it can be any
+ * of the four up to this one. '*offset' is set to where the block is.
+ */
+unsigned long find_block_page(struct m_inode * inode, unsigned long block,
+	int * offset)
+{
+	unsigned long page;
+	int i;
+
+	for (i = 0 ; i < 4 && i <= block ; i++)
+		if (page = find_page_cache(inode,block-i)) {
+			*offset = i*BLOCK_SIZE;
+			return page;
+		}
+	return 0;
+}
+
+/* is 'page' the cached page for 'block'? */
+int page_cache_holds(struct m_inode * inode, unsigned long block,
+	unsigned long page)
+{
+	struct page_cache_entry * e;
+
+	return inode->i_pages && (e = find_entry(inode,block)) &&
+		e->page == page;
+}
+
+/*
+ * update_page_cache() puts 'count' bytes just written at 'offset' in
+ * block 'block' of the file in the cached pages that hold the block.
+ */
+void update_page_cache(struct m_inode * inode, unsigned long block,
+	int offset, char * data, int count)
+{
+	struct page_cache_entry * e;
+	char * p;
+	int i;
+
+	if (!inode->i_pages)
+		return;
+	for (i = 0 ; i < 4 && i <= block ; i++)
+		if (e = find_entry(inode,block-i)) {
+			p = (char *) e->page + i*BLOCK_SIZE + offset;
+			if (p != data)
+				memcpy(p,data,count);
+		}
+}
+
+/*
+ * add_page_cache() enters a page that has just been read in. Returns 1
+ * if it is now cached (and must be mapped read-only), 0 if not.
+ */
+int add_page_cache(struct m_inode * inode, unsigned long block,
+	unsigned long page)
+{
+	struct page_cache_entry * e;
+
+	if (find_entry(inode,block) || !(e = reclaim_entry(1)))
+		return 0;
+	e->inode = inode;
+	e->block = block;
+	e->page = page;
+	e->referenced = 1;
+	e->next_hash = hash(inode,block);
+	hash(inode,block) = e;
+	inode->i_pages++;
+	mem_map[MAP_NR(page)]++;
+	return 1;
+}
+
+void invalidate_inode_pages(struct m_inode * inode)
+{
+	struct page_cache_entry * e;
+
+	if (!inode->i_pages)
+		return;
+	for (e = page_cache ; e < page_cache+NR_PAGE_CACHE ; e++)
+		if (e->inode == inode)
+			drop_entry(e);
+}
+
+/* free a cached page nobody uses. Returns 1 if there was one */
+int shrink_page_cache(void)
+{
+	return reclaim_entry(0) != NULL;
+}
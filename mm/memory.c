@@ -29,6 +29,7 @@
  */
 
 #include <signal.h>
+#include <sys/mman.h>
 
 #include <asm/system.h>
 
@@ -47,29 +48,187 @@ __asm__("cld ; rep ; movsl"::"S" (from),"D" (to),"c" (1024):"cx","di","si")
 unsigned char mem_map [ PAGING_PAGES ] = {0,};
 
 /*
- * Free a page of memory at physical address 'addr'. Used by
- * 'free_page_tables()'
+ * Every present page in a task's page tables counts in its rss: this
+ * is called whenever one is added or removed at linear address 'addr'.
  */
-void free_page(unsigned long addr)
+void add_rss(unsigned long addr, int nr)
+{
+	struct task_struct * p;
+
+	if (!(p = ADDR_TASK(addr)))
+		return;
+	p->rss += nr;
+	if (p->rss > p->max_rss)
+		p->max_rss = p->rss;
+}
+
+/*
+ * The buddy system. A free block of 2^order pages is on the list of
+ * its order, linked through its first page. Each pair of buddies has
+ * a bit in the map of their order, that changes every time one of them
+ * is allocated or freed: when freeing a block finds the bit clear, the
+ * buddy is free too, and the two are joined into one block of the next
+ * order. Blocks are aligned to their size (counting from LOW_MEM).
+ */
+struct mem_list {
+	struct mem_list * next;
+	struct mem_list * prev;
+};
+
+static struct mem_list free_area_list[NR_MEM_LISTS];
+static unsigned char free_area_map[NR_MEM_LISTS][PAGING_PAGES/16];
+int nr_free_pages = 0;
+
+#define BLOCK_ADDR(nr) (LOW_MEM + ((unsigned long) (nr) << 12))
+
+/* returns the old value of the buddy bit of page 'nr' */
+static inline int change_bit(unsigned long nr, int order)
+{
+	unsigned char * map = free_area_map[order] + (nr >> (order+4));
+	unsigned char mask = 1 << ((nr >> (order+1)) & 7);
+
+	*map ^= mask;
+	return !(*map & mask);
+}
+
+static inline void add_mem_queue(struct mem_list * head,
+	struct mem_list * entry)
+{
+	entry->prev = head;
+	(entry->next = head->next)->prev = entry;
+	head->next = entry;
+}
+
+static inline void remove_mem_queue(struct mem_list * entry)
+{
+	entry->next->prev = entry->prev;
+	entry->prev->next = entry->next;
+}
+
+/* called with interrupts off */
+static void free_pages_ok(unsigned long nr, int order)
 {
+	nr_free_pages += 1 << order;
+	while (order < NR_MEM_LISTS-1) {
+		if (!change_bit(nr,order))
+			break;
+		remove_mem_queue((struct mem_list *)
+			BLOCK_ADDR(nr ^ (1 << order)));
+		nr &= ~(1UL << order);
+		order++;
+	}
+	add_mem_queue(free_area_list+order,(struct mem_list *) BLOCK_ADDR(nr));
+}
+
+/*
+ * __get_free_pages() takes a block of the wanted order, splitting a
+ * bigger one if there is none. The block isn't cleared, and we don't
+ * try to swap: that's done by get_free_page(s) in swap.c.
+ */
+unsigned long __get_free_pages(int order)
+{
+	struct mem_list * block;
+	unsigned long flags,nr;
+	int i,new_order;
+
+	if (order < 0 || order >= NR_MEM_LISTS)
+		return 0;
+	save_flags(flags);
+	cli();
+	for (new_order = order ; new_order < NR_MEM_LISTS ; new_order++) {
+		block = free_area_list[new_order].next;
+		if (block == free_area_list+new_order)
+			continue;
+		remove_mem_queue(block);
+		nr = MAP_NR((unsigned long) block);
+		change_bit(nr,new_order);
+		while (new_order > order) {
+			new_order--;
+			add_mem_queue(free_area_list+new_order,(struct mem_list *)
+				BLOCK_ADDR(nr + (1 << new_order)));
+			change_bit(nr,new_order);
+		}
+		nr_free_pages -= 1 << order;
+		for (i = 0 ; i < (1 << order) ; i++)
+			mem_map[nr+i] = 1;
+		restore_flags(flags);
+		return (unsigned long) block;
+	}
+	restore_flags(flags);
+	return 0;
+}
+
+/*
+ * Free a block of memory at physical address 'addr'. It is given back
+ * to the buddy system when its last user goes.
+ */
+void free_pages(unsigned long addr, int order)
+{
+	unsigned long flags,nr;
+	int i;
+
 	if (addr < LOW_MEM) return;
 	if (addr >= HIGH_MEMORY)
 		panic("trying to free nonexistent page");
-	addr -= LOW_MEM;
-	addr >>= 12;
-	if (mem_map[addr]--) return;
-	mem_map[addr]=0;
-	panic("trying to free free page");
+	nr = MAP_NR(addr);
+	if (nr & ((1 << order) - 1))
+		panic("free_pages: misaligned block");
+	save_flags(flags);
+	cli();
+	if (!mem_map[nr]) {
+		restore_flags(flags);
+		panic("trying to free free page");
+	}
+	if (!--mem_map[nr]) {
+		for (i = 1 ; i < (1 << order) ; i++)
+			mem_map[nr+i] = 0;
+		free_pages_ok(nr,order);
+	}
+	restore_flags(flags);
+}
+
+/*
+ * Free a page of memory at physical address 'addr'. Used by
+ * 'free_page_tables()'
+ */
+void free_page(unsigned long addr)
+{
+	free_pages(addr,0);
+}
+
+/*
+ * release_table() drops the pages (and swap slots) a page table refers
+ * to, and clears it. Returns the number of pages that were present.
+ */
+static int release_table(unsigned long * pg_table)
+{
+	int nr, rss = 0;
+
+	for (nr=0 ; nr<1024 ; nr++) {
+		if (*pg_table) {
+			if (1 & *pg_table) {
+				free_page(0xfffff000 & *pg_table);
+				rss++;
+			} else
+				swap_free(*pg_table);
+			*pg_table = 0;
+		}
+		pg_table++;
+	}
+	return rss;
 }
 
 /*
  * This function frees a continuos block of page tables, as needed
  * by 'exit()'. As does copy_page_tables(), this handles only 4Mb blocks.
+ * A page table that is still shared with another process (see
+ * copy_page_tables()) is just let go of.
  */
 int free_page_tables(unsigned long from,unsigned long size)
 {
 	unsigned long *pg_table;
 	unsigned long * dir, nr;
+	int rss = 0;
 
 	if (from & 0x3fffff)
 		panic("free_page_tables called with wrong alignment");
@@ -81,23 +240,55 @@ int free_page_tables(unsigned long from,unsigned long size)
 		if (!(1 & *dir))
 			continue;
 		pg_table = (unsigned long *) (0xfffff000 & *dir);
-		for (nr=0 ; nr<1024 ; nr++) {
-			if (*pg_table) {
-				if (1 & *pg_table)
-					free_page(0xfffff000 & *pg_table);
-				else
-					swap_free(*pg_table >> 1);
-				*pg_table = 0;
-			}
-			pg_table++;
-		}
+		if (mem_map[MAP_NR((unsigned long) pg_table)] > 1) {
+			for (nr=0 ; nr<1024 ; nr++)
+				if (1 & pg_table[nr])
+					rss--;
+		} else
+			rss -= release_table(pg_table);
 		free_page(0xfffff000 & *dir);
 		*dir = 0;
 	}
 	invalidate();
+	add_rss(from,rss);
 	return 0;
 }
 
+/*
+ * copy_table() copies 'nr' entries of a page table, write-protecting
+ * the pages in both so that they are copied on write. A swapped-out
+ * page is swapped in first, as a swap slot can't be shared. Returns
+ * the number of pages swapped in, -1 if out of memory.
+ */
+static int copy_table(unsigned long * from_page_table,
+	unsigned long * to_page_table, int nr)
+{
+	unsigned long this_page;
+	int swapped = 0;
+
+	for ( ; nr-- > 0 ; from_page_table++,to_page_table++) {
+		this_page = *from_page_table;
+		if (!this_page)
+			continue;
+		if (!(1 & this_page)) {
+			swap_in(from_page_table);
+			this_page = *from_page_table;
+			if (!(1 & this_page))
+				return -1;
+			swapped++;
+		}
+		this_page &= ~2;
+		*to_page_table = this_page;
+		if (this_page > LOW_MEM) {
+			*from_page_table = this_page;
+			this_page -= LOW_MEM;
+			this_page >>= 12;
+			mem_map[this_page]++;
+		}
+	}
+	return swapped;
+}
+
 /*
  *  Well, here is one of the most complicated functions in mm. It
  * copies a range of linerar addresses by copying only the pages.
@@ -107,6 +298,12 @@ int free_page_tables(unsigned long from,unsigned long size)
  * be divisible by 4Mb (one page-directory entry), as this makes the
  * function easier. It's used only by fork anyway.
  *
+ * Most forks are followed by an exec, so we don't even copy the page
+ * tables: both directory entries point to the same table, which gets
+ * another reference in mem_map[] and is made read-only in them. The
+ * first process to change anything in it gets its own copy (see
+ * unshare_table()). The child thus starts with the parent's rss.
+ *
  * NOTE 2!! When from==0 we are copying kernel space for the first
  * fork(). Then we DONT want to copy a full page-directory entry, as
  * that would lead to some serious memory waste - we just copy the
@@ -119,10 +316,9 @@ int copy_page_tables(unsigned long from,unsigned long to,long size)
 {
 	unsigned long * from_page_table;
 	unsigned long * to_page_table;
-	unsigned long this_page;
 	unsigned long * from_dir, * to_dir;
-	unsigned long new_page;
 	unsigned long nr;
+	int swapped, to_rss;
 
 	if ((from&0x3fffff) || (to&0x3fffff))
 		panic("copy_page_tables called with wrong alignment");
@@ -134,37 +330,98 @@ int copy_page_tables(unsigned long from,unsigned long to,long size)
 			panic("copy_page_tables: already exist");
 		if (!(1 & *from_dir))
 			continue;
+		if (from) {
+			*from_dir &= ~2;
+			*to_dir = *from_dir;
+			mem_map[MAP_NR(*from_dir)]++;
+			continue;
+		}
 		from_page_table = (unsigned long *) (0xfffff000 & *from_dir);
 		if (!(to_page_table = (unsigned long *) get_free_page()))
 			return -1;	/* Out of memory, see freeing */
 		*to_dir = ((unsigned long) to_page_table) | 7;
-		nr = (from==0)?0xA0:1024;
-		for ( ; nr-- > 0 ; from_page_table++,to_page_table++) {
-			this_page = *from_page_table;
-			if (!this_page)
-				continue;
-			if (!(1 & this_page)) {
-				if (!(new_page = get_free_page()))
-					return -1;
-				read_swap_page(this_page>>1, (char *) new_page);
-				*to_page_table = this_page;
-				*from_page_table = new_page | (PAGE_DIRTY | 7);
-				continue;
-			}
-			this_page &= ~2;
-			*to_page_table = this_page;
-			if (this_page > LOW_MEM) {
-				*from_page_table = this_page;
-				this_page -= LOW_MEM;
-				this_page >>= 12;
-				mem_map[this_page]++;
-			}
-		}
+		if ((swapped = copy_table(from_page_table,to_page_table,0xA0)) < 0)
+			return -1;
+		add_rss(from,swapped);
+		for (nr = to_rss = 0 ; nr < 0xA0 ; nr++)
+			if (1 & to_page_table[nr])
+				to_rss++;
+		add_rss(to,to_rss);
 	}
+	if (from)
+		add_rss(to,ADDR_TASK(from)->rss);
 	invalidate();
 	return 0;
 }
 
+/*
+ * unshare_table() gives the current process its own copy of the page
+ * table for 'address' if it is still shared after a fork, so that it
+ * can be changed. The other process keeps the old one. Returns 0 if
+ * out of memory.
+ */
+int unshare_table(unsigned long address)
+{
+	unsigned long * dir = (unsigned long *) ((address>>20) & 0xffc);
+	unsigned long old_table, new_table;
+	int swapped;
+
+	if ((3 & *dir) != 1)
+		return 1;
+	old_table = 0xfffff000 & *dir;
+	if (mem_map[MAP_NR(old_table)] == 1) {
+		*dir |= 2;
+		invalidate();
+		return 1;
+	}
+	if (!(new_table = get_free_page()))
+		return 0;
+	if ((swapped = copy_table((unsigned long *) old_table,
+	    (unsigned long *) new_table, 1024)) < 0) {
+		release_table((unsigned long *) new_table);
+		free_page(new_table);
+		return 0;
+	}
+	add_rss(address,swapped);
+	if (mem_map[MAP_NR(old_table)] == 1)	/* the other one went away */
+		release_table((unsigned long *) old_table);
+	free_page(old_table);
+	*dir = new_table | 7;
+	invalidate();
+	return 1;
+}
+
+/*
+ * zap_page_range() frees the pages (and swap slots) of a page-aligned
+ * range of linear addresses, as munmap() needs.
+ */
+void zap_page_range(unsigned long from, unsigned long size)
+{
+	unsigned long * dir, * pte;
+	unsigned long address = from;
+	int rss = 0;
+
+	for ( ; size ; address += 4096, size -= 4096) {
+		dir = (unsigned long *) ((address>>20) & 0xffc);
+		if (!(1 & *dir))
+			continue;
+		if (!((unsigned long *) (0xfffff000 & *dir))[(address>>12) & 0x3ff])
+			continue;
+		if (!unshare_table(address))
+			oom();
+		pte = (unsigned long *) (0xfffff000 & *dir);
+		pte += (address>>12) & 0x3ff;
+		if (1 & *pte) {
+			free_page(0xfffff000 & *pte);
+			rss--;
+		} else
+			swap_free(*pte);
+		*pte = 0;
+	}
+	invalidate();
+	add_rss(from,rss);
+}
+
 /*
  * This function puts a page in memory at the wanted address.
  * It returns the physical address of the page gotten, 0 if
@@ -191,10 +448,36 @@ static unsigned long put_page(unsigned long page,unsigned long address)
 		page_table = (unsigned long *) tmp;
 	}
 	page_table[(address>>12) & 0x3ff] = page | 7;
+	add_rss(address,1);
 /* no need for invalidate */
 	return page;
 }
 
+/*
+ * put_shared_page() maps a page that is in the page cache as well. The
+ * caller has its reference: the page goes in read-only, so that writing
+ * to it makes a copy, unless it's for a shared writable mapping, where
+ * everybody writes to the cached page.
+ */
+static unsigned long put_shared_page(unsigned long page,unsigned long address,
+	int rw)
+{
+	unsigned long tmp, *page_table;
+
+	page_table = (unsigned long *) ((address>>20) & 0xffc);
+	if ((*page_table)&1)
+		page_table = (unsigned long *) (0xfffff000 & *page_table);
+	else {
+		if (!(tmp=get_free_page()))
+			return 0;
+		*page_table = tmp | 7;
+		page_table = (unsigned long *) tmp;
+	}
+	page_table[(address>>12) & 0x3ff] = page | (rw ? 7 : 5);
+	add_rss(address,1);
+	return page;
+}
+
 /*
  * The previous function doesn't work very well if you also want to mark
  * the page dirty: exec.c wants this, as it has earlier changed the page,
@@ -221,6 +504,7 @@ unsigned long put_dirty_page(unsigned long page, unsigned long address)
 		page_table = (unsigned long *) tmp;
 	}
 	page_table[(address>>12) & 0x3ff] = page | (PAGE_DIRTY | 7);
+	add_rss(address,1);
 /* no need for invalidate */
 	return page;
 }
@@ -237,13 +521,41 @@ void un_wp_page(unsigned long * table_entry)
 	}
 	if (!(new_page=get_free_page()))
 		oom();
-	if (old_page >= LOW_MEM)
-		mem_map[MAP_NR(old_page)]--;
+/* get_free_page() may have slept, and swapped the page out */
+	if ((0xfffff000 & *table_entry) != old_page || !(1 & *table_entry)) {
+		free_page(new_page);
+		return;
+	}
 	copy_page(old_page,new_page);
 	*table_entry = new_page | 7;
 	invalidate();
+	free_page(old_page);
 }	
 
+/*
+ * A cached page of a shared writable mapping is write-protected by
+ * fork(), but writing to it mustn't make a copy: it is just made
+ * writable again, so that everybody goes on using the same page.
+ */
+static int share_wp_page(unsigned long * table_entry, unsigned long address)
+{
+	struct vm_area_struct * vma;
+	unsigned long tmp;
+
+	tmp = address - current->start_code;
+	if (!(vma = find_vma(current,tmp)) || vma->vm_start > tmp ||
+	    !vma->vm_inode || !(vma->vm_flags & MAP_SHARED) ||
+	    !(vma->vm_prot & PROT_WRITE))
+		return 0;
+	tmp = vma->vm_offset + (tmp & 0xfffff000) - vma->vm_start;
+	if (!page_cache_holds(vma->vm_inode,tmp / BLOCK_SIZE,
+	    0xfffff000 & *table_entry))
+		return 0;
+	*table_entry |= 2;
+	invalidate();
+	return 1;
+}
+
 /*
  * This routine handles present pages, when users try to write
  * to a shared page. It is done by copying the page to a new address
@@ -253,33 +565,47 @@ void un_wp_page(unsigned long * table_entry)
  */
 void do_wp_page(unsigned long error_code,unsigned long address)
 {
+	struct vm_area_struct * vma;
+	unsigned long tmp, * table_entry;
+
 	if (address < TASK_SIZE)
 		printk("\n\rBAD! KERNEL MEMORY WP-ERR!\n\r");
 	if (address - current->start_code > TASK_SIZE) {
 		printk("Bad things happen: page error in do_wp_page\n\r");
 		do_exit(SIGSEGV);
 	}
+	current->min_flt++;
+	if (!unshare_table(address))
+		oom();
+	tmp = address - current->start_code;
+	if ((vma = find_vma(current,tmp)) && vma->vm_start <= tmp &&
+	    !(vma->vm_prot & PROT_WRITE))
+		do_exit(SIGSEGV);
 #if 0
 /* we cannot do this yet: the estdio library writes to code space */
 /* stupid, stupid. I really want the libc.a from GNU */
 	if (CODE_SPACE(address))
 		do_exit(SIGSEGV);
 #endif
-	un_wp_page((unsigned long *)
+	table_entry = (unsigned long *)
 		(((address>>10) & 0xffc) + (0xfffff000 &
-		*((unsigned long *) ((address>>20) &0xffc)))));
-
+		*((unsigned long *) ((address>>20) &0xffc))));
+	if (!share_wp_page(table_entry,address))
+		un_wp_page(table_entry);
 }
 
 void write_verify(unsigned long address)
 {
 	unsigned long page;
 
+	if (!unshare_table(address))
+		oom();
 	if (!( (page = *((unsigned long *) ((address>>20) & 0xffc)) )&1))
 		return;
 	page &= 0xfffff000;
 	page += ((address>>10) & 0xffc);
-	if ((3 & *(unsigned long *) page) == 1)  /* non-writeable, present */
+	if ((3 & *(unsigned long *) page) == 1 &&  /* non-writeable, present */
+	    !share_wp_page((unsigned long *) page,address))
 		un_wp_page((unsigned long *) page);
 	return;
 }
@@ -339,6 +665,7 @@ static int try_to_share(unsigned long address, struct task_struct * p)
 /* share them: write-protect */
 	*(unsigned long *) from_page &= ~2;
 	*(unsigned long *) to_page = *(unsigned long *) from_page;
+	add_rss(current->start_code,1);
 	invalidate();
 	phys_addr -= LOW_MEM;
 	phys_addr >>= 12;
@@ -378,6 +705,68 @@ static int share_page(struct m_inode * inode, unsigned long address)
 	return 0;
 }
 
+/*
+ * A page of an mmap()ed area: anonymous memory is zero-filled, a file
+ * is read in with bmap() and bread_page(), and zeroed past its end.
+ * A shared mapping must see the same page as everybody else, so its
+ * pages are always the cached ones (if there's room in the cache).
+ */
+static void do_mmap_page(struct vm_area_struct * vma, unsigned long address,
+	unsigned long tmp)
+{
+	struct m_inode * inode = vma->vm_inode;
+	unsigned long page, offset;
+	int nr[4];
+	int block,i,cache = 0;
+	int shared = vma->vm_flags & MAP_SHARED;
+	int rw = shared && (vma->vm_prot & PROT_WRITE);
+
+	if (!inode) {
+		current->min_flt++;
+		get_empty_page(address);
+		goto protect;
+	}
+	offset = vma->vm_offset + tmp - vma->vm_start;
+	block = offset / BLOCK_SIZE;
+/* only pages that are all file go in the page cache, if private */
+	if (shared || offset + 4096 <= inode->i_size) {
+		cache = 1;
+		if (page = find_page_cache(inode,block)) {
+			current->min_flt++;
+			if (put_shared_page(page,address,rw))
+				return;
+			free_page(page);
+			oom();
+		}
+	}
+	current->maj_flt++;
+	if (!(page = get_free_page()))
+		oom();
+	for (i=0 ; i<4 ; i++)
+		if ((block+i) * BLOCK_SIZE < inode->i_size)
+			nr[i] = bmap(inode,block+i);
+		else
+			nr[i] = 0;
+	bread_page(page,inode->i_dev,nr);
+	if (offset < inode->i_size && offset + 4096 > inode->i_size)
+		for (tmp = page + inode->i_size - offset ;
+		     tmp < page + 4096 ; tmp++)
+			*(char *) tmp = 0;
+	if (cache && add_page_cache(inode,block,page)) {
+		if (put_shared_page(page,address,rw))
+			return;
+	} else if (put_page(page,address))
+		goto protect;
+	free_page(page);
+	oom();
+protect:
+	if (!(vma->vm_prot & PROT_WRITE)) {
+		page = 0xfffff000 & *(unsigned long *) ((address >> 20) & 0xffc);
+		((unsigned long *) page)[(address >> 12) & 0x3ff] &= ~2;
+		invalidate();
+	}
+}
+
 void do_no_page(unsigned long error_code,unsigned long address)
 {
 	int nr[4];
@@ -385,6 +774,7 @@ void do_no_page(unsigned long error_code,unsigned long address)
 	unsigned long page;
 	int block,i;
 	struct m_inode * inode;
+	struct vm_area_struct * vma;
 
 	if (address < TASK_SIZE)
 		printk("\n\rBAD!! KERNEL PAGE MISSING\n\r");
@@ -392,18 +782,34 @@ void do_no_page(unsigned long error_code,unsigned long address)
 		printk("Bad things happen: nonexistent page error in do_no_page\n\r");
 		do_exit(SIGSEGV);
 	}
+	if (!unshare_table(address))
+		oom();
+	tmp = address - current->start_code;
+	if ((vma = find_vma(current,tmp)) && vma->vm_start > tmp)
+		vma = NULL;
+	if (vma && vma->vm_prot == PROT_NONE)
+		do_exit(SIGSEGV);
 	page = *(unsigned long *) ((address >> 20) & 0xffc);
 	if (page & 1) {
 		page &= 0xfffff000;
 		page += (address >> 10) & 0xffc;
 		tmp = *(unsigned long *) page;
 		if (tmp && !(1 & tmp)) {
+			current->maj_flt++;
 			swap_in((unsigned long *) page);
+			if (1 & *(unsigned long *) page)
+				add_rss(address,1);
+			if (vma && !(vma->vm_prot & PROT_WRITE))
+				*(unsigned long *) page &= ~2;
 			return;
 		}
 	}
 	address &= 0xfffff000;
 	tmp = address - current->start_code;
+	if (vma) {
+		do_mmap_page(vma,address,tmp);
+		return;
+	}
 	if (tmp >= LIBRARY_OFFSET ) {
 		inode = current->library;
 		block = 1 + (tmp-LIBRARY_OFFSET) / BLOCK_SIZE;
@@ -415,20 +821,38 @@ void do_no_page(unsigned long error_code,unsigned long address)
 		block = 0;
 	}
 	if (!inode) {
+		current->min_flt++;
 		get_empty_page(address);
 		return;
 	}
-	if (share_page(inode,tmp))
+	if (page = find_page_cache(inode,block)) {
+		current->min_flt++;
+		if (put_shared_page(page,address,0))
+			return;
+		free_page(page);
+		oom();
+	}
+	if (share_page(inode,tmp)) {
+		current->min_flt++;
 		return;
+	}
+	current->maj_flt++;
 	if (!(page = get_free_page()))
 		oom();
 /* remember that 1 block is used for header */
-	for (i=0 ; i<4 ; block++,i++)
-		nr[i] = bmap(inode,block);
+	for (i=0 ; i<4 ; i++)
+		nr[i] = bmap(inode,block+i);
 	bread_page(page,inode->i_dev,nr);
 	i = tmp + 4096 - current->end_data;
 	if (i>4095)
 		i = 0;
+/* the last page of the data has the bss cleared: don't cache that */
+	if (i <= 0 && add_page_cache(inode,block,page)) {
+		if (put_shared_page(page,address,0))
+			return;
+		free_page(page);
+		oom();
+	}
 	tmp = page + 4096;
 	while (i-- > 0) {
 		tmp--;
@@ -447,11 +871,14 @@ void mem_init(long start_mem, long end_mem)
 	HIGH_MEMORY = end_mem;
 	for (i=0 ; i<PAGING_PAGES ; i++)
 		mem_map[i] = USED;
-	i = MAP_NR(start_mem);
-	end_mem -= start_mem;
-	end_mem >>= 12;
-	while (end_mem-->0)
-		mem_map[i++]=0;
+	for (i=0 ; i<NR_MEM_LISTS ; i++)
+		free_area_list[i].next = free_area_list[i].prev =
+			free_area_list+i;
+	nr_free_pages = 0;
+	for ( ; start_mem < end_mem ; start_mem += 4096) {
+		mem_map[MAP_NR(start_mem)] = 0;
+		free_pages_ok(MAP_NR(start_mem),0);
+	}
 }
 
 void show_mem(void)
@@ -459,6 +886,7 @@ void show_mem(void)
 	int i,j,k,free=0,total=0;
 	int shared=0;
 	unsigned long * pg_tbl;
+	struct task_struct * p;
 
 	printk("Mem-info:\n\r");
 	for(i=0 ; i<PAGING_PAGES ; i++) {
@@ -471,6 +899,16 @@ void show_mem(void)
 			shared += mem_map[i]-1;
 	}
 	printk("%d free pages of %d\n\r",free,total);
+	printk("Free blocks:");
+	for (i=0 ; i<NR_MEM_LISTS ; i++) {
+		struct mem_list * p;
+
+		for (j=0, p=free_area_list[i].next ; p != free_area_list+i ;
+		     p=p->next)
+			j++;
+		printk(" %d*%dkB",j,4<<i);
+	}
+	printk(" = %d pages\n\r",nr_free_pages);
 	printk("%d pages shared\n\r",shared);
 	k = 0;
 	for(i=4 ; i<1024 ;) {
@@ -494,9 +932,15 @@ void show_mem(void)
 		i++;
 		if (!(i&15) && k) {
 			k++,free++;	/* one page/process for task_struct */
-			printk("Process %d: %d pages\n\r",(i>>4)-1,k);
+			printk("Process %d: %d pages",(i>>4)-1,k);
+			if (p = task[(i>>4)-1])
+				printk(" (rss %d, %d/%d faults, %d swapped out)",
+					p->rss,p->min_flt,p->maj_flt,p->nswap);
+			printk("\n\r");
 			k = 0;
 		}
 	}
 	printk("Memory found: %d (%d)\n\r",free-shared,total);
+	malloc_show();
+	kmem_cache_show();
 }
@@ -0,0 +1,305 @@
+/*
+ *  linux/mm/mmap.c
+ *
+ *  (C) 1991  Linus Torvalds
+ */
+
+/*
+ * mmap() and munmap(). A process' mappings are kept on a list of
+ * vm_area_structs sorted by address, and their pages are brought in by
+ * do_no_page() (see memory.c) when they are first touched.
+ *
+ * A shared mapping maps the pages in the page cache (see filemap.c)
+ * writable, so all the processes that map a file (and their children)
+ * see each other's changes at once, and read() and write() see them
+ * too. They go back to the file when the page is unmapped (or the
+ * process exits). A private mapping gets its own copy when it writes.
+ */
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <asm/segment.h>
+
+/* the first area that ends after 'addr', NULL if there is none */
+struct vm_area_struct * find_vma(struct task_struct * p, unsigned long addr)
+{
+	struct vm_area_struct * vma;
+
+	for (vma = p->mmap ; vma ; vma = vma->vm_next)
+		if (vma->vm_end > addr)
+			return vma;
+	return NULL;
+}
+
+static void insert_vma(struct vm_area_struct * new)
+{
+	struct vm_area_struct ** p;
+
+	for (p = &current->mmap ; *p ; p = &(*p)->vm_next)
+		if ((*p)->vm_start >= new->vm_end)
+			break;
+	new->vm_next = *p;
+	*p = new;
+}
+
+static void free_vma(struct vm_area_struct * vma)
+{
+	if (vma->vm_inode)
+		iput(vma->vm_inode);
+	free_s(vma,sizeof(*vma));
+}
+
+/* find 'len' free bytes for mmap(), 0 if there's no room */
+static unsigned long get_unmapped_area(unsigned long len)
+{
+	struct vm_area_struct * vma;
+	unsigned long addr;
+
+	addr = PAGE_ALIGN(current->brk);
+	if (addr < MMAP_START)
+		addr = MMAP_START;
+	for (vma = find_vma(current,addr) ; ; vma = vma->vm_next) {
+		if (addr + len > MMAP_END)
+			return 0;
+		if (!vma || addr + len <= vma->vm_start)
+			return addr;
+		addr = vma->vm_end;
+	}
+}
+
+/*
+ * Write the pages of a shared mapping that have been written to back to
+ * the file, and mark them clean: swap_out() then just drops them, and
+ * do_no_page() reads them back from the file. Swapped-out pages are
+ * dirty, so they are swapped in first. Mappings don't make a file grow:
+ * only blocks inside the file are written. A page that isn't the cached
+ * one (there was no room in the cache) puts its changes in the cached
+ * page as well, so nobody reads the old data from there.
+ */
+static void sync_vma(struct vm_area_struct * vma, unsigned long start,
+	unsigned long end)
+{
+	struct m_inode * inode = vma->vm_inode;
+	struct buffer_head * bh;
+	unsigned long address, offset, page;
+	unsigned long * dir, * pte;
+	int i,block;
+
+	for ( ; start < end ; start += 4096) {
+		address = current->start_code + start;
+		dir = (unsigned long *) ((address>>20) & 0xffc);
+		if (!(1 & *dir))
+			continue;
+		pte = (unsigned long *) (0xfffff000 & *dir);
+		pte += (address>>12) & 0x3ff;
+		if (!*pte || (*pte & (PAGE_PRESENT | PAGE_DIRTY)) == PAGE_PRESENT)
+			continue;
+		if (!unshare_table(address))
+			oom();
+		pte = (unsigned long *) (0xfffff000 & *dir);
+		pte += (address>>12) & 0x3ff;
+		if (!(1 & *pte)) {
+			swap_in(pte);
+			if (!(1 & *pte))
+				continue;
+			add_rss(address,1);
+		}
+		*pte &= ~PAGE_DIRTY;
+		invalidate();
+		page = 0xfffff000 & *pte;
+/* we may sleep below, and swap_out() could take the clean page away */
+		mem_map[MAP_NR(page)]++;
+		offset = vma->vm_offset + start - vma->vm_start;
+		for (i = 0 ; i < 4 ; i++, offset += BLOCK_SIZE) {
+			if (offset >= inode->i_size)
+				break;
+			if (!(block = create_block(inode,offset / BLOCK_SIZE)))
+				break;
+			if (!(bh = getblk(inode->i_dev,block)))
+				break;
+			memcpy(bh->b_data,(char *) page + i*BLOCK_SIZE,BLOCK_SIZE);
+			bh->b_uptodate = 1;
+			bh->b_dirt = 1;
+			brelse(bh);
+			update_page_cache(inode,offset / BLOCK_SIZE,0,
+				(char *) page + i*BLOCK_SIZE,BLOCK_SIZE);
+		}
+		free_page(page);
+	}
+}
+
+static int do_munmap(unsigned long addr, unsigned long len)
+{
+	struct vm_area_struct * vma, * new, ** p;
+	unsigned long start, end;
+
+	if ((addr & 4095) || !len)
+		return -EINVAL;
+	len = PAGE_ALIGN(len);
+	if (addr + len < addr || addr + len > TASK_SIZE)
+		return -EINVAL;
+	p = &current->mmap;
+	while (vma = *p) {
+		if (vma->vm_end <= addr) {
+			p = &vma->vm_next;
+			continue;
+		}
+		if (vma->vm_start >= addr + len)
+			break;
+		start = vma->vm_start > addr ? vma->vm_start : addr;
+		end = vma->vm_end < addr + len ? vma->vm_end : addr + len;
+		new = NULL;
+		if (start > vma->vm_start && end < vma->vm_end &&
+		    !(new = (struct vm_area_struct *) malloc(sizeof(*new))))
+			return -ENOMEM;
+		if (vma->vm_inode && (vma->vm_flags & MAP_SHARED))
+			sync_vma(vma,start,end);
+		zap_page_range(current->start_code + start, end - start);
+		if (new) {		/* a hole in the middle */
+			*new = *vma;
+			new->vm_start = end;
+			new->vm_offset += end - vma->vm_start;
+			if (new->vm_inode)
+				new->vm_inode->i_count++;
+			vma->vm_end = start;
+			vma->vm_next = new;
+			break;
+		}
+		if (start > vma->vm_start) {
+			vma->vm_end = start;
+			p = &vma->vm_next;
+			continue;
+		}
+		if (end < vma->vm_end) {
+			vma->vm_offset += end - vma->vm_start;
+			vma->vm_start = end;
+			break;
+		}
+		*p = vma->vm_next;
+		free_vma(vma);
+	}
+	return 0;
+}
+
+/*
+ * mmap() has six arguments, more than fit in registers: 'buffer'
+ * points to them.
+ */
+int sys_mmap(unsigned long * buffer)
+{
+	unsigned long addr,len,off;
+	int prot,flags,fd,error;
+	struct file * file;
+	struct m_inode * inode = NULL;
+	struct vm_area_struct * vma;
+
+	addr = get_fs_long(buffer);
+	len = get_fs_long(buffer+1);
+	prot = get_fs_long(buffer+2);
+	flags = get_fs_long(buffer+3);
+	fd = get_fs_long(buffer+4);
+	off = get_fs_long(buffer+5);
+	if (!len || (off & 4095))
+		return -EINVAL;
+	len = PAGE_ALIGN(len);
+	if (!len)
+		return -EINVAL;
+	switch (flags & MAP_TYPE) {
+		case MAP_SHARED:
+		case MAP_PRIVATE:
+			break;
+		default:
+			return -EINVAL;
+	}
+	if (!(flags & MAP_ANONYMOUS)) {
+		if (fd < 0 || fd >= NR_OPEN || !(file = current->filp[fd]))
+			return -EBADF;
+		inode = file->f_inode;
+		if (!S_ISREG(inode->i_mode))
+			return -ENODEV;
+		if ((file->f_flags & O_ACCMODE) == O_WRONLY)
+			return -EACCES;
+		if ((flags & MAP_TYPE) == MAP_SHARED && (prot & PROT_WRITE) &&
+		    (file->f_flags & O_ACCMODE) != O_RDWR)
+			return -EACCES;
+	}
+	if (flags & MAP_FIXED) {
+		if ((addr & 4095) || addr < PAGE_ALIGN(current->brk) ||
+		    addr + len < addr || addr + len > MMAP_END)
+			return -EINVAL;
+	} else if (!(addr = get_unmapped_area(len)))
+		return -ENOMEM;
+	if (!(vma = (struct vm_area_struct *) malloc(sizeof(*vma))))
+		return -ENOMEM;
+	if ((flags & MAP_FIXED) && (error = do_munmap(addr,len))) {
+		free_s(vma,sizeof(*vma));
+		return error;
+	}
+	vma->vm_start = addr;
+	vma->vm_end = addr + len;
+	vma->vm_offset = off;
+	vma->vm_inode = inode;
+	vma->vm_prot = prot;
+	vma->vm_flags = flags;
+	if (inode)
+		inode->i_count++;
+	insert_vma(vma);
+	return addr;
+}
+
+int sys_munmap(unsigned long addr, unsigned long len)
+{
+	return do_munmap(addr,len);
+}
+
+/* give the new process 'p' a copy of our list of mappings */
+int copy_mmap(struct task_struct * p)
+{
+	struct vm_area_struct * vma, * new, ** tail;
+
+	p->mmap = NULL;
+	tail = &p->mmap;
+	for (vma = current->mmap ; vma ; vma = vma->vm_next) {
+		if (!(new = (struct vm_area_struct *) malloc(sizeof(*new)))) {
+			free_mmap(p);
+			return -ENOMEM;
+		}
+		*new = *vma;
+		new->vm_next = NULL;
+		if (new->vm_inode)
+			new->vm_inode->i_count++;
+		*tail = new;
+		tail = &new->vm_next;
+	}
+	return 0;
+}
+
+void free_mmap(struct task_struct * p)
+{
+	struct vm_area_struct * vma;
+
+	while (vma = p->mmap) {
+		p->mmap = vma->vm_next;
+		free_vma(vma);
+	}
+}
+
+/*
+ * Called by exit() and exec() before they free the page tables: shared
+ * mappings are written back, and the list is freed.
+ */
+void exit_mmap(void)
+{
+	struct vm_area_struct * vma;
+
+	for (vma = current->mmap ; vma ; vma = vma->vm_next)
+		if (vma->vm_inode && (vma->vm_flags & MAP_SHARED))
+			sync_vma(vma,vma->vm_start,vma->vm_end);
+	free_mmap(current);
+}
@@ -10,6 +10,11 @@
  */
 
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <asm/system.h>
 
 #include <linux/mm.h>
 #include <linux/sched.h>
@@ -32,7 +37,46 @@ bitop(bit,"")
 bitop(setbit,"s")
 bitop(clrbit,"r")
 
-static char * swap_bitmap = NULL;
+/*
+ * Pages can be swapped to several swap areas, block devices or regular
+ * files, added with swapon() and removed with swapoff(). The areas are
+ * kept on a list sorted by priority: pages go to the area with the
+ * highest priority that has room, and are spread round-robin over the
+ * areas with the same priority.
+ *
+ * A swapped-out page table entry holds the area in bits 1-7 and the
+ * slot within it in bits 12-31 (bit 0, present, is clear). Each area
+ * starts with a page holding the bit-map of its good slots and the
+ * "SWAP-SPACE" signature, so it can hold at most SWAP_BITS pages.
+ */
+#define MAX_SWAPFILES 8
+
+#define SWP_TYPE(entry) (((entry) >> 1) & 0x7f)
+#define SWP_OFFSET(entry) ((entry) >> 12)
+#define SWP_ENTRY(type,offset) (((type) << 1) | ((offset) << 12))
+
+#define SWP_USED	1
+#define SWP_WRITEOK	3
+
+static struct swap_info_struct {
+	unsigned int flags;
+	unsigned short swap_device;
+	struct m_inode * swap_file;	/* NULL for a block device */
+	char * swap_map;		/* bit set = slot free */
+	int pages;
+	int inuse;
+	int cluster_next;
+	int prio;
+	int next;			/* next area on swap_list */
+} swap_info[MAX_SWAPFILES];
+
+static int nr_swapfiles = 0;
+static int least_priority = 0;
+static struct {
+	int head;	/* area with the highest priority */
+	int next;	/* area to try first */
+} swap_list = {-1, -1};
+
 int SWAP_DEV = 0;
 
 /*
@@ -43,80 +87,518 @@ int SWAP_DEV = 0;
 #define LAST_VM_PAGE (1024*1024)
 #define VM_PAGES (LAST_VM_PAGE - FIRST_VM_PAGE)
 
-static int get_swap_page(void)
+/* the area of a swap entry, NULL if the entry is bad */
+static struct swap_info_struct * swap_area(unsigned long entry)
+{
+	struct swap_info_struct * p;
+
+	if (SWP_TYPE(entry) >= nr_swapfiles)
+		return NULL;
+	p = swap_info + SWP_TYPE(entry);
+	if (!(p->flags & SWP_USED))
+		return NULL;
+	if (!SWP_OFFSET(entry) || SWP_OFFSET(entry) >= p->pages)
+		return NULL;
+	return p;
+}
+
+/*
+ * Swap slots are handed out in clusters: scan_swap_map() starts a new
+ * cluster where SWAP_CLUSTER slots in a row are free, and the pages
+ * swapped out after it get the slots that follow. Neighbouring pages
+ * thus end up next to each other on the disk, and can be written (and
+ * read back) with one request.
+ */
+#define SWAP_CLUSTER 8
+
+static int scan_swap_map(struct swap_info_struct * p)
+{
+	int nr,run;
+
+	nr = p->cluster_next;
+	if (nr < p->pages && clrbit(p->swap_map,nr))
+		goto got;
+	for (nr = 1, run = 0 ; nr < p->pages ; nr++) {
+		if (!bit(p->swap_map,nr)) {
+			run = 0;
+			continue;
+		}
+		if (++run == SWAP_CLUSTER) {
+			nr -= SWAP_CLUSTER-1;
+			clrbit(p->swap_map,nr);
+			goto got;
+		}
+	}
+	for (nr = 1 ; nr < p->pages ; nr++)
+		if (clrbit(p->swap_map,nr))
+			goto got;
+	return 0;
+got:
+	p->cluster_next = nr+1;
+	p->inuse++;
+	return nr;
+}
+
+static unsigned long get_swap_page(void)
+{
+	struct swap_info_struct * p;
+	int type,offset,wrapped = 0;
+
+	type = swap_list.next;
+	if (type < 0)
+		return 0;
+	while (1) {
+		p = swap_info + type;
+		if ((p->flags & SWP_WRITEOK) == SWP_WRITEOK &&
+		    (offset = scan_swap_map(p))) {
+			swap_list.next = p->next;
+			if (p->next < 0 || swap_info[p->next].prio != p->prio)
+				swap_list.next = swap_list.head;
+			return SWP_ENTRY(type,offset);
+		}
+		type = p->next;
+		if (!wrapped) {
+			if (type < 0 || swap_info[type].prio != p->prio) {
+				type = swap_list.head;
+				wrapped = 1;
+			}
+		} else if (type < 0)
+			return 0;
+	}
+}
+
+/* get 'entry' if it is free: used to extend a cluster */
+static unsigned long get_swap_entry(unsigned long entry)
+{
+	struct swap_info_struct * p;
+
+	if (!(p = swap_area(entry)) || (p->flags & SWP_WRITEOK) != SWP_WRITEOK)
+		return 0;
+	if (!clrbit(p->swap_map,SWP_OFFSET(entry)))
+		return 0;
+	p->cluster_next = SWP_OFFSET(entry)+1;
+	p->inuse++;
+	return entry;
+}
+
+static void release_swap_entry(struct swap_info_struct * p,
+	unsigned long entry)
+{
+	if (setbit(p->swap_map,SWP_OFFSET(entry)))
+		printk("Swap-space bad (swap entry %08x freed twice)\n\r",entry);
+	else
+		p->inuse--;
+}
+
+static inline void wait_on_buffer(struct buffer_head * bh)
+{
+	cli();
+	while (bh->b_lock)
+		sleep_on(&bh->b_wait);
+	sti();
+}
+
+/*
+ * Swap i/o is done on four buffer heads per page, that aren't in the
+ * buffer cache. For a swap file, bmap() tells where the blocks are.
+ */
+static void setup_swap_bh(struct buffer_head * bh, unsigned long entry,
+	unsigned long page)
+{
+	struct swap_info_struct * p = swap_info + SWP_TYPE(entry);
+	int i, block = SWP_OFFSET(entry)*4;
+
+	for (i = 0 ; i < 4 ; i++, bh++, block++) {
+		if (p->swap_file) {
+			bh->b_dev = p->swap_file->i_dev;
+			bh->b_blocknr = bmap(p->swap_file,block);
+		} else {
+			bh->b_dev = p->swap_device;
+			bh->b_blocknr = block;
+		}
+		bh->b_data = (char *) page + i*BLOCK_SIZE;
+		bh->b_uptodate = 0;
+		bh->b_dirt = 0;
+		bh->b_reqnext = NULL;
+	}
+}
+
+/* start i/o on buffers, with one request per run of adjacent blocks */
+static void rw_swap_buffers(int rw, struct buffer_head ** bhs, int n)
+{
+	int i,start;
+
+	for (start = 0, i = 1 ; i <= n ; i++) {
+		if (i < n && bhs[i]->b_dev == bhs[i-1]->b_dev &&
+		    bhs[i]->b_blocknr == bhs[i-1]->b_blocknr+1) {
+			bhs[i-1]->b_reqnext = bhs[i];
+			continue;
+		}
+		bhs[i-1]->b_reqnext = NULL;
+		ll_rw_chain(rw,bhs[start]);
+		start = i;
+	}
+}
+
+/* synchronous i/o on one page. Returns 0 on error */
+static int rw_swap_page(int rw, unsigned long entry, char * buf)
+{
+	struct buffer_head bh[4], * bhs[4];
+	int i,ok = 1;
+
+	memset(bh,0,sizeof(bh));
+	setup_swap_bh(bh,entry,(unsigned long) buf);
+	for (i = 0 ; i < 4 ; i++)
+		bhs[i] = bh+i;
+	rw_swap_buffers(rw,bhs,4);
+	for (i = 0 ; i < 4 ; i++) {
+		wait_on_buffer(bh+i);
+		if (!bh[i].b_uptodate)
+			ok = 0;
+	}
+	return ok;
+}
+
+/*
+ * The swap cache holds the pages that are on their way to or from a
+ * swap slot outside of any page table, each with the four buffer heads
+ * used for its i/o. swap_out() puts the pages it writes here, so that
+ * a fault on one of them before the write is done just takes the page
+ * back. swap_in() reads the slots after the one it wants into pages
+ * that wait here until they are faulted in - or until the slot is
+ * freed, or the memory is needed (shrink_swap_cache()).
+ *
+ * A SC_READING entry is being read into, or its readahead is still
+ * being set up: anybody else who wants it waits on swap_cache_wait. A
+ * SC_WRITING entry is being written: a fault takes its page back (and
+ * 'page' is cleared), but the slot itself can't be used again until the
+ * write is done, so if it is freed meanwhile ('freed') it is the writer
+ * that gives it back. SC_IDLE entries hold a page read ahead.
+ */
+#define NR_SWAP_CACHE 32
+
+#define SC_IDLE		0
+#define SC_READING	1
+#define SC_WRITING	2
+
+static struct swap_cache_entry {
+	unsigned long entry;	/* swap entry, 0 if unused */
+	int state;
+	int freed;
+	unsigned long page;
+	struct buffer_head bh[4];
+} swap_cache[NR_SWAP_CACHE];
+
+static struct wait_queue * swap_cache_wait = NULL;
+
+static inline int swap_cache_locked(struct swap_cache_entry * e)
+{
+	return e->bh[0].b_lock || e->bh[1].b_lock ||
+		e->bh[2].b_lock || e->bh[3].b_lock;
+}
+
+static struct swap_cache_entry * find_swap_cache(unsigned long entry)
+{
+	struct swap_cache_entry * e;
+
+	for (e = swap_cache ; e < swap_cache+NR_SWAP_CACHE ; e++)
+		if (e->entry == entry)
+			return e;
+	return NULL;
+}
+
+/*
+ * shrink_swap_cache() frees the page of an entry that is just waiting
+ * to be faulted in. Returns 1 if it found one.
+ */
+int shrink_swap_cache(void)
 {
-	int nr;
+	struct swap_cache_entry * e;
 
-	if (!swap_bitmap)
+	for (e = swap_cache ; e < swap_cache+NR_SWAP_CACHE ; e++)
+		if (e->entry && e->state == SC_IDLE && !swap_cache_locked(e)) {
+			e->entry = 0;
+			free_page(e->page);
+			return 1;
+		}
+	return 0;
+}
+
+/* get a cache entry in 'state' for 'entry' and 'page', NULL if none free */
+static struct swap_cache_entry * add_swap_cache(unsigned long entry,
+	unsigned long page, int state)
+{
+	struct swap_cache_entry * e;
+
+	for (e = swap_cache ; e < swap_cache+NR_SWAP_CACHE ; e++)
+		if (!e->entry && e->state == SC_IDLE)
+			break;
+	if (e >= swap_cache+NR_SWAP_CACHE) {
+		if (!shrink_swap_cache())
+			return NULL;
+		return add_swap_cache(entry,page,state);
+	}
+	e->entry = entry;
+	e->state = state;
+	e->freed = 0;
+	e->page = page;
+	return e;
+}
+
+static void unlock_swap_cache(struct swap_cache_entry * e)
+{
+	e->state = SC_IDLE;
+	wake_up(&swap_cache_wait);
+}
+
+/* start i/o on cache entries for consecutive slots */
+static void rw_swap_cache(int rw, struct swap_cache_entry ** e, int n)
+{
+	struct buffer_head * bhs[4*SWAP_CLUSTER];
+	int i,j;
+
+	for (i = 0 ; i < n ; i++) {
+		setup_swap_bh(e[i]->bh,e[i]->entry,e[i]->page);
+		for (j = 0 ; j < 4 ; j++)
+			bhs[i*4+j] = e[i]->bh+j;
+	}
+	rw_swap_buffers(rw,bhs,n*4);
+}
+
+static int wait_on_swap_cache(struct swap_cache_entry * e)
+{
+	int i,ok = 1;
+
+	for (i = 0 ; i < 4 ; i++) {
+		wait_on_buffer(e->bh+i);
+		if (!e->bh[i].b_uptodate)
+			ok = 0;
+	}
+	return ok;
+}
+
+/*
+ * Forget the cached copy of a slot that is freed. A readahead page is
+ * freed. If the slot is being written, it stays in use until the write
+ * is done, and try_to_swap_out() frees it: returns 1 then.
+ */
+static int drop_swap_cache(struct swap_cache_entry * e, unsigned long entry)
+{
+	while (e->entry == entry && e->state == SC_READING)
+		sleep_on(&swap_cache_wait);
+	if (e->entry != entry)
 		return 0;
-	for (nr = 1; nr < 32768 ; nr++)
-		if (clrbit(swap_bitmap,nr))
-			return nr;
+	if (e->state == SC_WRITING) {
+		e->freed = 1;
+		return 1;
+	}
+	e->state = SC_READING;
+	wait_on_swap_cache(e);
+	e->entry = 0;
+	free_page(e->page);
+	unlock_swap_cache(e);
 	return 0;
 }
 
-void swap_free(int swap_nr)
+void swap_free(unsigned long entry)
 {
-	if (!swap_nr)
+	struct swap_info_struct * p;
+	struct swap_cache_entry * e;
+
+	if (!entry)
 		return;
-	if (swap_bitmap && swap_nr < SWAP_BITS)
-		if (!setbit(swap_bitmap,swap_nr))
-			return;
-	printk("Swap-space bad (swap_free())\n\r");
-	return;
+	if (!(p = swap_area(entry))) {
+		printk("Swap-space bad (swap_free())\n\r");
+		return;
+	}
+	if ((e = find_swap_cache(entry)) && drop_swap_cache(e,entry))
+		return;
+	release_swap_entry(p,entry);
 }
 
-void swap_in(unsigned long *table_ptr)
+/*
+ * read_swap_cluster() reads 'entry' into 'page', and starts reading
+ * the slots in use after it into the swap cache, as far as there are
+ * free pages and entries for them (readahead never swaps anything out).
+ * Only the wanted slot is waited for.
+ */
+static void read_swap_cluster(unsigned long entry, unsigned long page)
 {
-	int swap_nr;
-	unsigned long page;
+	struct swap_info_struct * p = swap_info + SWP_TYPE(entry);
+	struct swap_cache_entry * e[SWAP_CLUSTER];
+	unsigned long ra_page, ra_entry;
+	int i,n;
 
-	if (!swap_bitmap) {
-		printk("Trying to swap in without swap bit-map");
+	if (!(e[0] = add_swap_cache(entry,page,SC_READING))) {
+		if (!rw_swap_page(READ,entry,(char *) page))
+			printk("swap_in: read error on swap entry %08x\n\r",entry);
 		return;
 	}
+	for (n = 1 ; n < SWAP_CLUSTER ; n++) {
+		ra_entry = entry + SWP_ENTRY(0,n);
+		if (SWP_OFFSET(ra_entry) >= p->pages ||
+		    bit(p->swap_map,SWP_OFFSET(ra_entry)) ||
+		    find_swap_cache(ra_entry))
+			break;
+		if (!(ra_page = __get_free_pages(0)))
+			break;
+		if (!(e[n] = add_swap_cache(ra_entry,ra_page,SC_READING))) {
+			free_page(ra_page);
+			break;
+		}
+	}
+	rw_swap_cache(READ,e,n);
+/* the reads are all started now: the buffers say when they are done */
+	for (i = 1 ; i < n ; i++)
+		unlock_swap_cache(e[i]);
+	if (!wait_on_swap_cache(e[0]))
+		printk("swap_in: read error on swap entry %08x\n\r",entry);
+	e[0]->entry = 0;
+	unlock_swap_cache(e[0]);
+}
+
+void swap_in(unsigned long *table_ptr)
+{
+	struct swap_info_struct * p;
+	struct swap_cache_entry * e;
+	unsigned long entry, page;
+
 	if (1 & *table_ptr) {
 		printk("trying to swap in present page\n\r");
 		return;
 	}
-	swap_nr = *table_ptr >> 1;
-	if (!swap_nr) {
+	entry = *table_ptr;
+	if (!(p = swap_area(entry))) {
 		printk("No swap page in swap_in\n\r");
 		return;
 	}
-	if (!(page = get_free_page()))
-		oom();
-	read_swap_page(swap_nr, (char *) page);
-	if (setbit(swap_bitmap,swap_nr))
-		printk("swapping in multiply from same page\n\r");
+	page = 0;
+	while ((e = find_swap_cache(entry)) && e->state == SC_READING) {
+		sleep_on(&swap_cache_wait);
+		if (*table_ptr != entry)
+			return;
+	}
+	if (e && e->state == SC_WRITING) {
+/* still being written: take the page back, the writer frees the slot */
+		*table_ptr = e->page | (PAGE_DIRTY | 7);
+		e->page = 0;
+		e->freed = 1;
+		return;
+	}
+	if (e) {
+		e->state = SC_READING;
+		if (wait_on_swap_cache(e))
+			page = e->page;
+		else
+			free_page(e->page);
+		e->entry = 0;
+		unlock_swap_cache(e);
+	}
+	if (!page) {
+		if (!(page = get_free_page()))
+			oom();
+		read_swap_cluster(entry,page);
+	}
+	release_swap_entry(p,entry);
 	*table_ptr = page | (PAGE_DIRTY | 7);
 }
 
-int try_to_swap_out(unsigned long * table_ptr)
+/* can this page go in the same cluster as the one before it? */
+static inline int can_cluster(unsigned long page)
 {
+	if ((page & (PAGE_PRESENT | PAGE_ACCESSED | PAGE_DIRTY)) !=
+	    (PAGE_PRESENT | PAGE_DIRTY))
+		return 0;
+	if (page - LOW_MEM > PAGING_MEMORY)
+		return 0;
+	return mem_map[MAP_NR(page & 0xfffff000)] == 1;
+}
+
+/*
+ * Pages get a second chance (the clock algorithm): a page that has
+ * been used since we last looked at it just loses its accessed bit,
+ * and is only swapped out if it is still unused when we come round
+ * again. 'p' is the task the page belongs to, 'max' the number of
+ * entries left in the page table.
+ *
+ * A dirty page is written out together with the dirty and unused
+ * pages that follow it, to the following slots, with one request.
+ * Returns the number of pages freed. The writing may sleep, and 'p'
+ * may have exited by the time it is done, so it is counted first.
+ */
+int try_to_swap_out(unsigned long * table_ptr, int max,
+	struct task_struct * p)
+{
+	struct swap_cache_entry * e[SWAP_CLUSTER];
 	unsigned long page;
-	unsigned long swap_nr;
+	unsigned long entry;
+	int i,n;
 
 	page = *table_ptr;
 	if (!(PAGE_PRESENT & page))
 		return 0;
 	if (page - LOW_MEM > PAGING_MEMORY)
 		return 0;
+/* leave page tables still shared after a fork alone */
+	if (mem_map[MAP_NR((unsigned long) table_ptr)] > 1)
+		return 0;
+	if (PAGE_ACCESSED & page) {
+		*table_ptr = page & ~PAGE_ACCESSED;
+		return 0;
+	}
 	if (PAGE_DIRTY & page) {
 		page &= 0xfffff000;
 		if (mem_map[MAP_NR(page)] != 1)
 			return 0;
-		if (!(swap_nr = get_swap_page()))
+		if (!(entry = get_swap_page()))
 			return 0;
-		*table_ptr = swap_nr<<1;
+		if (!(e[0] = add_swap_cache(entry,page,SC_WRITING))) {
+			*table_ptr = entry;
+			invalidate();
+			if (p) {
+				p->rss--;
+				p->nswap++;
+			}
+			rw_swap_page(WRITE,entry,(char *) page);
+			free_page(page);
+			return 1;
+		}
+		for (n = 1 ; n < SWAP_CLUSTER && n < max ; n++) {
+			if (!can_cluster(table_ptr[n]))
+				break;
+			if (!get_swap_entry(entry + SWP_ENTRY(0,n)))
+				break;
+			if (!(e[n] = add_swap_cache(entry + SWP_ENTRY(0,n),
+			    table_ptr[n] & 0xfffff000,SC_WRITING))) {
+				swap_free(entry + SWP_ENTRY(0,n));
+				break;
+			}
+		}
+		for (i = 0 ; i < n ; i++)
+			table_ptr[i] = entry + SWP_ENTRY(0,i);
 		invalidate();
-		write_swap_page(swap_nr, (char *) page);
-		free_page(page);
-		return 1;
+		if (p) {
+			p->rss -= n;
+			p->nswap += n;
+		}
+		rw_swap_cache(WRITE,e,n);
+		for (i = 0 ; i < n ; i++) {
+			wait_on_swap_cache(e[i]);
+			if (e[i]->page)
+				free_page(e[i]->page);
+			if (e[i]->freed)
+				release_swap_entry(swap_area(e[i]->entry),
+					e[i]->entry);
+			e[i]->entry = 0;
+			unlock_swap_cache(e[i]);
+		}
+		return n;
 	}
 	*table_ptr = 0;
 	invalidate();
 	free_page(page);
+	if (p)
+		p->rss--;
 	return 1;
 }
 
@@ -124,12 +606,17 @@ int try_to_swap_out(unsigned long * table_ptr)
  * Ok, this has a rather intricate logic - the idea is to make good
  * and fast machine code. If we didn't worry about that, things would
  * be easier.
+ *
+ * We may have to go round twice: once to clear the accessed bits, and
+ * once to find them still clear. The TLB is flushed after each page
+ * table, so that the processor sets the bits again for the pages it
+ * goes on using.
  */
 int swap_out(void)
 {
 	static int dir_entry = FIRST_VM_PAGE>>10;
 	static int page_entry = -1;
-	int counter = VM_PAGES;
+	int counter = 2*VM_PAGES;
 	int pg_table;
 
 	while (counter>0) {
@@ -158,96 +645,302 @@ int swap_out(void)
 					break;
 			pg_table &= 0xfffff000;
 		}
-		if (try_to_swap_out(page_entry + (unsigned long *) pg_table))
+		if (try_to_swap_out(page_entry + (unsigned long *) pg_table,
+		    1024 - page_entry, ADDR_TASK(dir_entry << 22)))
 			return 1;
+		if (page_entry == 1023)
+			invalidate();
 	}
+	invalidate();
 	printk("Out of swap-memory\n\r");
 	return 0;
 }
 
 /*
- * Get physical address of first (actually last :-) free page, and mark it
- * used. If no free pages left, return 0.
+ * Get physical address of a free page, mark it used and clear it. If
+ * no free pages left, try to swap something out, and return 0 if that
+ * doesn't work either.
  */
 unsigned long get_free_page(void)
 {
-register unsigned long __res asm("ax");
+	unsigned long page;
 
 repeat:
-	__asm__("std ; repne ; scasb\n\t"
-		"jne 1f\n\t"
-		"movb $1,1(%%edi)\n\t"
-		"sall $12,%%ecx\n\t"
-		"addl %2,%%ecx\n\t"
-		"movl %%ecx,%%edx\n\t"
-		"movl $1024,%%ecx\n\t"
-		"leal 4092(%%edx),%%edi\n\t"
-		"rep ; stosl\n\t"
-		"movl %%edx,%%eax\n"
-		"1:"
-		:"=a" (__res)
-		:"0" (0),"i" (LOW_MEM),"c" (PAGING_PAGES),
-		"D" (mem_map+PAGING_PAGES-1)
-		:"di","cx","dx");
-	if (__res >= HIGH_MEMORY)
-		goto repeat;
-	if (!__res && swap_out())
+	if (page = __get_free_pages(0)) {
+		__asm__("cld ; rep ; stosl"
+			::"a" (0),"c" (1024),"D" (page)
+			:"cx","di");
+		return page;
+	}
+	if (shrink_swap_cache() || shrink_page_cache() ||
+	    kmem_cache_shrink() || swap_out())
 		goto repeat;
-	return __res;
+	return 0;
 }
 
-void init_swapping(void)
+/*
+ * get_free_pages() gets a cleared block of 2^order contiguous pages.
+ * Swapping out frees single pages anywhere, so it may take a while
+ * before two buddies are free: we give up after a number of tries.
+ */
+unsigned long get_free_pages(int order)
+{
+	unsigned long page;
+	int tries = 32 << order;
+
+	if (!order)
+		return get_free_page();
+	while (!(page = __get_free_pages(order)))
+		if (order >= NR_MEM_LISTS || --tries < 0 ||
+		    !(shrink_swap_cache() || shrink_page_cache() ||
+		      kmem_cache_shrink() || swap_out()))
+			return 0;
+	__asm__("cld ; rep ; stosl"
+		::"a" (0),"c" (1024 << order),"D" (page)
+		:"cx","di");
+	return page;
+}
+
+/* put area 'type' on swap_list, after the areas of higher priority */
+static void insert_swap_area(int type)
+{
+	struct swap_info_struct * p = swap_info + type;
+	int i,prev = -1;
+
+	for (i = swap_list.head ; i >= 0 ; i = swap_info[i].next) {
+		if (p->prio >= swap_info[i].prio)
+			break;
+		prev = i;
+	}
+	p->next = i;
+	if (prev < 0)
+		swap_list.head = type;
+	else
+		swap_info[prev].next = type;
+	swap_list.next = swap_list.head;
+}
+
+/*
+ * add_swap_area() sets up a swap area on the block device 'dev', or on
+ * the regular file 'inode' (which it then keeps) if that isn't NULL.
+ */
+static int add_swap_area(int dev, struct m_inode * inode, int prio)
 {
 	extern int *blk_size[];
-	int swap_size,i,j;
+	struct swap_info_struct * p;
+	int type,size,i,j;
 
-	if (!SWAP_DEV)
-		return;
-	if (!blk_size[MAJOR(SWAP_DEV)]) {
+	for (type = 0, p = swap_info ; type < nr_swapfiles ; type++, p++)
+		if ((p->flags & SWP_USED) && (inode ? p->swap_file == inode :
+		    (!p->swap_file && p->swap_device == dev)))
+			return -EBUSY;
+	for (type = 0, p = swap_info ; type < nr_swapfiles ; type++, p++)
+		if (!(p->flags & SWP_USED))
+			break;
+	if (type >= MAX_SWAPFILES)
+		return -EPERM;
+	if (type == nr_swapfiles)
+		nr_swapfiles++;
+	p->flags = SWP_USED;
+	p->swap_device = dev;
+	p->swap_file = inode;
+	p->swap_map = NULL;
+	p->pages = 0;
+	if (inode)
+		size = inode->i_size >> 12;
+	else if (blk_size[MAJOR(dev)])
+		size = blk_size[MAJOR(dev)][MINOR(dev)] >> 2;
+	else {
 		printk("Unable to get size of swap device\n\r");
-		return;
+		goto bad;
 	}
-	swap_size = blk_size[MAJOR(SWAP_DEV)][MINOR(SWAP_DEV)];
-	if (!swap_size)
-		return;
-	if (swap_size < 100) {
-		printk("Swap device too small (%d blocks)\n\r",swap_size);
-		return;
+	if (size < 25) {
+		printk("Swap area too small (%d pages)\n\r",size);
+		goto bad;
 	}
-	swap_size >>= 2;
-	if (swap_size > SWAP_BITS)
-		swap_size = SWAP_BITS;
-	swap_bitmap = (char *) get_free_page();
-	if (!swap_bitmap) {
+	if (size > SWAP_BITS)
+		size = SWAP_BITS;
+	if (inode)
+		for (i = 0 ; i < 4 ; i++)
+			if (!bmap(inode,i))
+				goto bad;
+	p->swap_map = (char *) get_free_page();
+	if (!p->swap_map) {
 		printk("Unable to start swapping: out of memory :-)\n\r");
-		return;
+		goto bad;
 	}
-	read_swap_page(0,swap_bitmap);
-	if (strncmp("SWAP-SPACE",swap_bitmap+4086,10)) {
+	if (!rw_swap_page(READ,SWP_ENTRY(type,0),p->swap_map) ||
+	    strncmp("SWAP-SPACE",p->swap_map+4086,10)) {
 		printk("Unable to find swap-space signature\n\r");
-		free_page((long) swap_bitmap);
-		swap_bitmap = NULL;
-		return;
+		goto bad;
 	}
-	memset(swap_bitmap+4086,0,10);
+	memset(p->swap_map+4086,0,10);
 	for (i = 0 ; i < SWAP_BITS ; i++) {
 		if (i == 1)
-			i = swap_size;
-		if (bit(swap_bitmap,i)) {
+			i = size;
+		if (bit(p->swap_map,i)) {
 			printk("Bad swap-space bit-map\n\r");
-			free_page((long) swap_bitmap);
-			swap_bitmap = NULL;
-			return;
+			goto bad;
 		}
 	}
+/* slots with holes in a swap file can't be used */
+	if (inode)
+		for (i = 1 ; i < size ; i++)
+			for (j = 0 ; j < 4 ; j++)
+				if (!bmap(inode,i*4+j)) {
+					clrbit(p->swap_map,i);
+					break;
+				}
 	j = 0;
-	for (i = 1 ; i < swap_size ; i++)
-		if (bit(swap_bitmap,i))
+	for (i = 1 ; i < size ; i++)
+		if (bit(p->swap_map,i))
 			j++;
-	if (!j) {
-		free_page((long) swap_bitmap);
-		swap_bitmap = NULL;
-		return;
+	if (!j)
+		goto bad;
+	p->pages = size;
+	p->inuse = 0;
+	p->cluster_next = 1;
+	p->prio = prio;
+	p->flags = SWP_WRITEOK;
+	insert_swap_area(type);
+	printk("Adding swap: %d pages (%d bytes) swap-space, priority %d\n\r",
+		j,j*4096,prio);
+	return 0;
+bad:
+	if (p->swap_map)
+		free_page((long) p->swap_map);
+	p->swap_map = NULL;
+	p->swap_file = NULL;
+	p->flags = 0;
+	return -EINVAL;
+}
+
+/*
+ * Slots freed while they were being written are only given back when
+ * the write is done. Returns 1 if it had to wait for any.
+ */
+static int wait_for_swap_writes(void)
+{
+	struct swap_cache_entry * e;
+	int waited = 0;
+
+	for (e = swap_cache ; e < swap_cache+NR_SWAP_CACHE ; e++)
+		while (e->state == SC_WRITING) {
+			sleep_on(&swap_cache_wait);
+			waited = 1;
+		}
+	return waited;
+}
+
+/*
+ * try_to_unuse() swaps in every page of area 'type', which is no
+ * longer on swap_list so nothing new gets swapped out to it.
+ */
+static int try_to_unuse(int type)
+{
+	struct swap_info_struct * p = swap_info + type;
+	unsigned long * pg_table;
+	unsigned long entry;
+	int dir,nr,found;
+
+	while (p->inuse) {
+		found = 0;
+		for (dir = FIRST_VM_PAGE>>10 ; dir < 1024 ; dir++) {
+			if (!(1 & pg_dir[dir]))
+				continue;
+			pg_table = (unsigned long *) (0xfffff000 & pg_dir[dir]);
+			for (nr = 0 ; nr < 1024 ; nr++) {
+				entry = pg_table[nr];
+				if (!entry || (1 & entry) || SWP_TYPE(entry) != type)
+					continue;
+				swap_in(pg_table+nr);
+				if (!(1 & pg_table[nr]))
+					return -ENOMEM;
+				add_rss((dir << 22) + (nr << 12),1);
+				found++;
+			}
+		}
+		if (!found && p->inuse) {
+			if (wait_for_swap_writes())
+				continue;
+			printk("swapoff: %d swap pages lost\n\r",p->inuse);
+			return -EBUSY;
+		}
+	}
+	return 0;
+}
+
+int sys_swapon(const char * specialfile, int swap_flags)
+{
+	struct m_inode * inode;
+	int prio,error;
+
+	if (!suser())
+		return -EPERM;
+	if (!(inode = namei(specialfile)))
+		return -ENOENT;
+	if (swap_flags & SWAP_FLAG_PREFER)
+		prio = swap_flags & SWAP_FLAG_PRIO_MASK;
+	else
+		prio = --least_priority;
+	if (S_ISBLK(inode->i_mode)) {
+		error = add_swap_area(inode->i_zone[0],NULL,prio);
+		iput(inode);
+		return error;
 	}
-	printk("Swap device ok: %d pages (%d bytes) swap-space\n\r",j,j*4096);
+	if (!S_ISREG(inode->i_mode)) {
+		iput(inode);
+		return -EINVAL;
+	}
+	if (error = add_swap_area(0,inode,prio))
+		iput(inode);
+	return error;
+}
+
+int sys_swapoff(const char * specialfile)
+{
+	struct swap_info_struct * p;
+	struct m_inode * inode;
+	int type,prev = -1,error;
+
+	if (!suser())
+		return -EPERM;
+	if (!(inode = namei(specialfile)))
+		return -ENOENT;
+	for (type = swap_list.head ; type >= 0 ; type = p->next) {
+		p = swap_info + type;
+		if (p->swap_file ? p->swap_file == inode :
+		    (S_ISBLK(inode->i_mode) && p->swap_device == inode->i_zone[0]))
+			break;
+		prev = type;
+	}
+	iput(inode);
+	if (type < 0)
+		return -EINVAL;
+	if (prev < 0)
+		swap_list.head = p->next;
+	else
+		swap_info[prev].next = p->next;
+	swap_list.next = swap_list.head;
+	p->flags = SWP_USED;
+	if (error = try_to_unuse(type)) {
+		p->flags = SWP_WRITEOK;
+		insert_swap_area(type);
+		return error;
+	}
+	if (p->swap_file)
+		iput(p->swap_file);
+	p->swap_file = NULL;
+	free_page((long) p->swap_map);
+	p->swap_map = NULL;
+	p->pages = 0;
+	p->flags = 0;
+	return 0;
+}
+
+/* the boot-time swap device, see tools/build */
+void init_swapping(void)
+{
+	if (SWAP_DEV)
+		add_swap_area(SWAP_DEV,NULL,--least_priority);
 }